@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2040 Dark Energy Processor Corporation
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+
+// Compares named reference lookup through std::map<std::string, int> and
+// the "Live2LOVE" registry key (as RefData used to do) with the
+// enum-indexed RefData::getRef.
+
+// std
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+
+// Lua
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+// RefData
+#include "RefData.h"
+
+static const int iterations = 2000000;
+
+// Previous RefData lookup
+static std::map<std::string, int> namedRef;
+
+static void getRefString(lua_State *L, const std::string &name)
+{
+	if (namedRef.find(name) == namedRef.end())
+		lua_pushnil(L);
+	else
+	{
+		lua_pushstring(L, "Live2LOVE");
+		lua_rawget(L, LUA_REGISTRYINDEX);
+		lua_rawgeti(L, -1, namedRef[name]);
+		lua_remove(L, -2);
+	}
+}
+
+template<typename F> static double measure(F func)
+{
+	auto start = std::chrono::steady_clock::now();
+	func();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+int main()
+{
+	lua_State *L = luaL_newstate();
+	luaL_newmetatable(L, "Live2LOVE");
+	RefData::setMainTable(L, -1);
+
+	// Register some values under both schemes
+	static const char *names[] = {"love.graphics.draw", "love.graphics.setShader", "love.graphics.stencil", "love.graphics.transformPoint"};
+	static const RefData::NamedRefID ids[] = {
+		RefData::LOVE_GRAPHICS_DRAW,
+		RefData::LOVE_GRAPHICS_SETSHADER,
+		RefData::LOVE_GRAPHICS_STENCIL,
+		RefData::LOVE_GRAPHICS_TRANSFORMPOINT
+	};
+	static const int count = sizeof(ids) / sizeof(ids[0]);
+
+	for (int i = 0; i < count; i++)
+	{
+		lua_pushinteger(L, i);
+		RefData::setRef(L, ids[i], -1);
+		namedRef[names[i]] = RefData::setRef(L, -1);
+		lua_pop(L, 1);
+	}
+
+	// std::string key is made on every call, like the callers used to do
+	double stringTime = measure([L]()
+	{
+		for (int i = 0; i < iterations; i++)
+		{
+			getRefString(L, names[i % count]);
+			lua_pop(L, 1);
+		}
+	});
+
+	double enumTime = measure([L]()
+	{
+		for (int i = 0; i < iterations; i++)
+		{
+			RefData::getRef(L, ids[i % count]);
+			lua_pop(L, 1);
+		}
+	});
+
+	printf("std::map<std::string, int> lookup: %.1f ns\n", stringTime);
+	printf("enum-indexed lookup: %.1f ns\n", enumTime);
+
+	lua_close(L);
+	return 0;
+}
@@ -0,0 +1,16 @@
+function love.conf(t)
+    t.version = "11.0"
+    t.window.title = "Live2LOVE update() benchmark"
+    t.window.width = 320
+    t.window.height = 240
+    t.modules.audio = false
+    t.modules.joystick = false
+    t.modules.math = false
+    t.modules.mouse = false
+    t.modules.physics = false
+    t.modules.sound = false
+    t.modules.system = false
+    t.modules.thread = false
+    t.modules.touch = false
+    t.modules.video = false
+end
@@ -0,0 +1,82 @@
+-- Copyright (c) 2040 Dark Energy Processor Corporation
+--
+-- This software is provided 'as-is', without any express or implied
+-- warranty.  In no event will the authors be held liable for any damages
+-- arising from the use of this software.
+--
+-- Permission is granted to anyone to use this software for any purpose,
+-- including commercial applications, and to alter it and redistribute it
+-- freely, subject to the following restrictions:
+--
+-- 1. The origin of this software must not be misrepresented; you must not
+--    claim that you wrote the original software. If you use this software
+--    in a product, an acknowledgment in the product documentation would be
+--    appreciated but is not required.
+-- 2. Altered source versions must be plainly marked as such, and must not be
+--    misrepresented as being the original software.
+-- 3. This notice may not be removed or altered from any source distribution.
+
+-- Live2LOVE update() benchmark
+-- Usage: love bench/update <model definition> [frames]
+-- Model path is relative to this directory or the save directory, e.g. copy
+-- the Haru sample model to bench/update/Res/Haru and pass
+-- Res/Haru/Haru.model3.json. Each case is timed with one deformation update
+-- per frame (current) and with two (the update path before 0.6.0).
+local love = require("love")
+local Live2LOVE = require("Live2LOVE")
+
+local frames = 2000
+local warmup = 100
+local dt = 1 / 60
+
+-- Time frames update() calls. setPost is called before every update.
+local function measure(model, setPost)
+	for _ = 1, warmup do
+		setPost(model)
+		model:update(dt)
+	end
+
+	local start = love.timer.getTime()
+	for _ = 1, frames do
+		setPost(model)
+		model:update(dt)
+	end
+
+	return (love.timer.getTime() - start) / frames
+end
+
+-- Print current and old update path timing of a case
+local function compare(name, model, setPost)
+	Live2LOVE._setDoubleUpdate(true)
+	local old = measure(model, setPost)
+	Live2LOVE._setDoubleUpdate(false)
+	local new = measure(model, setPost)
+	print(string.format(
+		"%s: %.1f us/frame, was %.1f us/frame (%.1f%% saved)",
+		name, new * 1e6, old * 1e6, (old - new) / old * 100
+	))
+end
+
+function love.load(arg)
+	local modelPath = arg[1]
+	if not(modelPath) then
+		error("model definition path expected. Usage: love bench/update <model definition> [frames]", 0)
+	end
+	frames = tonumber(arg[2]) or frames
+
+	local model = Live2LOVE.loadModel(modelPath)
+	local param = model:getParamInfoList()[1]
+	print("Live2D Version "..Live2LOVE.Live2DVersion)
+	print(string.format("%s, %d frames", modelPath, frames))
+
+	compare("update() without post params", model, function() end)
+
+	if param then
+		local value = (param.min + param.max) / 2
+		compare("update() with post params ("..param.name..")", model, function(m)
+			m:setParamValuePost(param.name, value)
+		end)
+	end
+
+	love.event.quit()
+end
@@ -15,9 +15,10 @@
 -- Only use this if your model file does lack of model definition
 -- or your library (or your responsibility) to control the paths.
 -- @tparam string moc Model file path.
+-- @tparam[opt] table settings Model settings (see `loadModel`).
 -- @treturn Live2LOVEModel Model object
 -- @raise error when the model file is not recognized.
-function loadMocFile(moc)
+function loadMocFile(moc, settings)
 end
 
 --- Load model definition and fully initialize model.
@@ -25,9 +26,26 @@ end
 -- way and most of the model preparation is handled.
 -- by this function.
 -- @tparam string model Model definition file path (JSON).
+-- @tparam[opt] table imageSettings Settings passed to love.graphics.newImage.
+-- @tparam[opt] table settings Model settings. Currently supported fields:  
+-- 1. `meshMode`: "separate" (default) creates one Mesh per drawable. "shared" puts
+-- all drawables in one Mesh and uploads all vertices in one call every update,
+-- but `getMesh` can't be used.
 -- @treturn Live2LOVEModel Model object.
 -- @raise error when it fails to load (due to many factor).
-function loadModel(model)
+function loadModel(model, imageSettings, settings)
+end
+
+--- Update multiple models at once.
+-- This is same as calling `update` for every model, but the model simulation
+-- (motion, physics, deformation, and vertex transformation) runs in worker threads.
+-- Only the vertex upload happens in the calling thread.
+-- Pending background simulation of pipelined models is finished first, then
+-- the models are simulated for this frame as usual.
+-- @tparam table models List of Live2LOVEModel objects.
+-- @tparam number dT Time elapsed since last frame in seconds.
+-- @raise error when any of the model fails to update.
+function updateAll(models, dT)
 end
 
 --- This is model object
@@ -40,18 +58,259 @@ end
 function setParamValue(name, value, weight)
 end
 
+--- Get parameter handle.
+-- Parameter handle resolves the parameter name once, so the `ByHandle` variants
+-- of parameter functions don't have to look up the name on every call.
+-- Handle `i` is the same parameter as `getParamInfoList()[i]`.
+-- @tparam string name Parameter name.
+-- @treturn number Parameter handle, or nil if the model doesn't have such parameter.
+function getParamHandle(name)
+end
+
+--- Set parameter value of model using parameter handle.
+-- `setParamValuePostByHandle`, `addParamValueByHandle`, and `mulParamValueByHandle`
+-- work the same way as their name-based variants.
+-- @tparam number handle Parameter handle from `getParamHandle`.
+-- @tparam number value Parameter value.
+-- @tparam[opt] number weight Parameter weight (defaults to 1).
+-- @raise error when the handle is invalid.
+function setParamValueByHandle(handle, value, weight)
+end
+
+--- Get parameter value of model using parameter handle.
+-- @tparam number handle Parameter handle from `getParamHandle`.
+-- @treturn number Parameter value.
+-- @raise error when the handle is invalid.
+function getParamValueByHandle(handle)
+end
+
+--- Set multiple parameter values in one call.
+-- `setParamsPost`, `addParams`, and `mulParams` work the same way as
+-- `setParamValuePost`, `addParamValue`, and `mulParamValue` respectively.
+-- @tparam table params List of parameter names or parameter handles (can be mixed).
+-- @tparam table values List of parameter values.
+-- @tparam[opt] table weights List of parameter weights (missing weight defaults to 1).
+-- @raise error when a parameter handle is invalid or value is not a number.
+function setParams(params, values, weights)
+end
+
+--- Get multiple parameter values in one call.
+-- @tparam table params List of parameter names or parameter handles (can be mixed).
+-- @tparam[opt] table out Table to store the values to (new table is created if absent).
+-- @treturn table List of parameter values (`out` if specified).
+-- @raise error when a parameter handle is invalid.
+function getParams(params, out)
+end
+
+--- Get LuaJIT FFI pointers to the model parameter and part arrays.
+-- Reading and writing these arrays doesn't involve any function call, so LuaJIT
+-- can compile loops which use them. Arrays are 0-based. Parameter index `i` is
+-- the same parameter as parameter handle `i + 1`. The pointers are valid as long
+-- as the model object is alive, so keep a reference to the model too!
+-- @treturn table Table with these fields:  
+-- 1. `parameterCount`: Amount of parameters.  
+-- 2. `parameterValues`: `float*` of parameter values.  
+-- 3. `parameterMinimumValues`, `parameterMaximumValues`, `parameterDefaultValues`: `const float*`
+-- of parameter minimum, maximum, and default values.  
+-- 4. `parameterIndex`: Table of parameter name to its index.  
+-- 5. `partCount`: Amount of parts.  
+-- 6. `partOpacities`: `float*` of part opacities.  
+-- 7. `partIndex`: Table of part name to its index.
+-- @raise error when LuaJIT FFI is not available.
+function getFFIData()
+end
+
 --- Retrieve LÖVE Mesh object of specified index or all Mesh objects.
+-- Meshes are ordered by their drawable index, which doesn't change between updates.
+-- Vertices of invisible drawables are not updated. Vertices only have
+-- `VertexPosition` and `VertexColor`; `VertexTexCoord` is attached from a static
+-- Mesh shared by clones.
 -- @tparam[opt] number index Index to get it's Mesh data (defaults to nil).
 -- @return List of Mesh objects (in a table) or specified Mesh object for specified index.
--- @raise error when index is out of range.
+-- @raise error when index is out of range or the model uses shared mesh mode.
 function getMesh(index)
 end
 
+--- Create new model object from this model.
+-- The new model shares the moc and textures with this model, so creating many
+-- copies of the same character is much cheaper than loading it again. Texture
+-- coordinates and the loaded motion, expression, physics and pose JSON are shared
+-- too. Physics and pose are parsed when cloning, and motions and expressions when
+-- the new model first starts them. Loading into either model afterwards doesn't
+-- affect the other. The new model has its own parameters, motion
+-- playback, eye blink and breath, and starts from default parameter values. Settings
+-- like mesh mode, simulation rate, update interval, culling, batching,
+-- clipping mode and render cache are copied.
+-- @treturn Live2LOVEModel New model object.
+-- @raise error when the new model can't be initialized.
+function clone()
+end
+
 --- Update model.
+-- Only drawables which vertices or opacity changed are uploaded.
 -- @tparam number dT Time elapsed since last frame in seconds.
 function update(dT)
 end
 
+--- Enable or disable pipelined update.
+-- When enabled, `update` uploads the result of the previous simulation and then
+-- simulates the next frame in a worker thread, so the simulation overlaps with
+-- drawing. The drawn model is one frame behind. Functions which read or modify
+-- the model state (parameters, motions, expressions, ...) wait for the background
+-- simulation to finish first, but writes through `getFFIData` pointers don't, so
+-- only use them after calling `getFFIData` again in the same frame.
+--
+-- Loading models, motions, expressions, physics, pose, eye blink, and breath, as
+-- well as `clone` and parameter functions by name, can register new parameter IDs,
+-- which are shared by all models. These wait for background simulations of all
+-- models, not only their own.
+-- @tparam boolean pipelined Enable pipelined update?
+-- @raise error when the pending simulation failed.
+function setPipelined(pipelined)
+end
+
+--- Is pipelined update enabled?
+-- @treturn boolean Pipelined update status.
+function isPipelined()
+end
+
+--- Simulate the model at fixed rate.
+-- Motion, physics, and deformation are stepped with fixed time step regardless of
+-- the `dT` passed to `update`, at most `substeps` times per update (excess time
+-- is dropped). The vertices are interpolated between the last two steps, so the
+-- model still moves smoothly when the frame rate is higher than the simulation
+-- rate. The drawn model lags by up to one step.
+--
+-- Post-update parameters (`setParamValuePost`) only take effect on simulated
+-- steps. Updates which run no step discard them, so set them on every update.
+-- @tparam number rate Simulation rate in Hz (e.g. 30 or 60), or 0 to simulate once
+-- per update with variable time step (default).
+-- @tparam[opt=4] number substeps Maximum simulation steps per update.
+function setSimulationRate(rate, substeps)
+end
+
+--- Get simulation rate.
+-- @treturn number Simulation rate in Hz, or 0 if variable time step is used.
+-- @treturn number Maximum simulation steps per update.
+function getSimulationRate()
+end
+
+--- Set update level of detail.
+-- Background or small models don't need to be simulated every frame. With
+-- interval `n`, the model is simulated once every `n` updates with the time
+-- elapsed since the last simulation, and the vertices are interpolated between
+-- the last two simulations in between, so the model lags by up to `n` updates.
+-- Use `setSimulationRate` to simulate at fixed rate in Hz instead, which takes
+-- precedence over the update interval.
+-- Like with `setSimulationRate`, post-update parameters set before an update
+-- which doesn't simulate are discarded.
+-- @tparam number interval Simulate every `interval` updates (1 = every update).
+function setUpdateInterval(interval)
+end
+
+--- Pick update interval automatically based on the scale passed to `draw`.
+-- Drawing with scale of `fullScale` or larger simulates every update. Smaller scales
+-- simulate less often, e.g. half of `fullScale` simulates every 2 updates.
+-- Use `setUpdateInterval(1)` to disable it.
+-- @tparam string mode Must be "auto".
+-- @tparam[opt=1] number fullScale Smallest draw scale which is simulated every update.
+-- @tparam[opt=4] number maxInterval Maximum update interval.
+function setUpdateInterval(mode, fullScale, maxInterval)
+end
+
+--- Get update interval which is used in next update.
+-- @treturn number Update interval.
+function getUpdateInterval()
+end
+
+--- Get bounding box of the visible drawables.
+-- The bounding box is in model coordinates, the same coordinates used by `draw`
+-- before it applies the position, rotation, scale, origin, and shearing, and it's
+-- updated by `update`. It can be used to skip updating offscreen models.
+-- @treturn number Top-left X position, or nil if nothing is visible.
+-- @treturn number Top-left Y position.
+-- @treturn number Width.
+-- @treturn number Height.
+function getBounds()
+end
+
+--- Set culling rectangle.
+-- If the bounding box of the model, transformed by `draw` arguments and current
+-- `love.graphics` transformation, is completely outside this rectangle, `draw`
+-- does nothing. Usually this is the screen rectangle `0, 0, love.graphics.getDimensions()`.
+-- Call without arguments to disable culling (default).
+-- @tparam number x Rectangle X position in screen coordinates.
+-- @tparam number y Rectangle Y position in screen coordinates.
+-- @tparam number w Rectangle width.
+-- @tparam number h Rectangle height.
+function setCullRect(x, y, w, h)
+end
+
+--- Enable or disable batching.
+-- When enabled, consecutive drawables which use the same texture and blend mode
+-- and have no masks are drawn in one draw call. The index buffer of the shared
+-- Mesh is rearranged in draw order every time the draw order or visibility of
+-- the drawables changes.
+-- @tparam boolean batching Enable batching?
+-- @raise error when enabling it and the model doesn't use shared mesh mode.
+function setBatching(batching)
+end
+
+--- Is batching enabled?
+-- @treturn boolean Batching status.
+function isBatching()
+end
+
+--- Enable or disable render cache.
+-- When enabled, the model is drawn to an internal canvas at its draw scale,
+-- and the canvas is drawn instead of the model until any drawable, the draw
+-- order, the draw scale or a texture changes. A model which doesn't move costs
+-- one textured quad per `draw`. The cache is drawn with the current color,
+-- shader and love.graphics transformation, so a scaled transformation may blur
+-- it, and the current Shader applies to the cached image rather than to each
+-- drawable. Models larger than 4096x4096 pixels at draw scale are drawn directly.
+--
+-- The cache is only correct for models which use normal blending. While any
+-- visible drawable uses multiply or additive blending, the cache is not used
+-- and the model is drawn directly.
+-- @tparam boolean cache Enable render cache?
+-- @raise error when the cache canvas can't be created.
+function setRenderCache(cache)
+end
+
+--- Is render cache enabled?
+-- @treturn boolean Render cache status.
+function isRenderCache()
+end
+
+--- Set clipping mode.
+-- "stencil" (default) draws the masks of every masked drawable to the stencil
+-- buffer before drawing it. "canvas" draws all mask sets once per `draw` to the
+-- RGBA channels of a mask canvas, and masked drawables sample it in a shader.
+-- Up to 36 distinct mask sets fit in the mask canvas, the rest uses stencil.
+-- In "canvas" mode, masks of masks are ignored and the shader set by the user
+-- is not applied to masked drawables.
+-- @tparam string mode Clipping mode, "stencil" or "canvas".
+-- @tparam[opt=512] number size Mask canvas width and height.
+-- @raise error when the mask canvas can't be created.
+function setClippingMode(mode, size)
+end
+
+--- Get clipping mode.
+-- @treturn string Clipping mode.
+-- @treturn number Mask canvas size (only in "canvas" mode).
+function getClippingMode()
+end
+
+--- Get statistics of the last update.
+-- @treturn table Statistics table with these fields:  
+-- 1. `uploadedDrawables`: Amount of drawables which vertices were uploaded.  
+-- 2. `hiddenDrawables`: Amount of drawables which are invisible or fully transparent.
+-- These are not drawn, and their vertices are not updated unless they're used as mask.  
+-- 3. `drawCalls`: Amount of draw calls to draw the drawables, excluding masks.
+function getStats()
+end
+
 --- Draw model.
 -- Drawing Live2D model object is done using love.graphics.draw,
 -- which means that, for example, current transformation stack and
@@ -63,6 +322,25 @@ end
 function draw()
 end
 
+--- Draw the current pose of the model at multiple placements.
+-- Every instance is drawn in the same draw calls using
+-- love.graphics.drawInstanced, so drawing a crowd costs about as many draw
+-- calls as drawing the model once. Instances are placed by a shader, which
+-- replaces the current Shader, and the current transformation stack is applied
+-- on top of the instance placement. Use `clone` for instances which need
+-- different poses.
+--
+-- Instances which don't overlap on screen share their masks in the stencil
+-- buffer, so their masked drawables are drawn instanced too. Overlapping
+-- instances are split to groups, and masked drawables are drawn once per
+-- group, so stacked crowds with many masks gain less from instancing.
+-- @tparam table instances List of instances. Each instance is a table with the
+-- same values as `love.graphics.draw` arguments: `{x, y, r, sx, sy, ox, oy, kx, ky}`,
+-- and optional `color` field with tint color `{r, g, b, a}`.
+-- @raise error when the clipping mode is "canvas" or instancing isn't supported.
+function drawInstanced(instances)
+end
+
 --- Set model expression.
 -- @tparam string name Expression name.
 -- @raise error when there are no expressions loaded, initialization failure, or expression with specified name does not exist.
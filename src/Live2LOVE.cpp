@@ -20,13 +20,18 @@
 
 // std
 #include <cmath>
+#include <climits>
+#include <cstring>
+#include <limits>
 
 // STL
 #include <algorithm>
+#include <array>
 #include <functional>
 #include <exception>
 #include <map>
 #include <new>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -51,6 +56,9 @@ extern "C" {
 // RefData
 #include "RefData.h"
 
+// VertexKernel
+#include "VertexKernel.h"
+
 // Live2D
 #include "Id/CubismIdManager.hpp"
 #include "CubismDefaultParameterId.hpp"
@@ -60,8 +68,10 @@ inline std::string fromCsmString(const Live2D::Cubism::Framework::csmString &str
 	return std::string(str.GetRawString(), (size_t) str.GetLength());
 }
 
+// Get Cubism ID, registering it if needed
 inline const Live2D::Cubism::Framework::CubismId *toCsmString(const std::string &str)
 {
+	live2love::Live2LOVE::waitAllSimulations();
 	Live2D::Cubism::Framework::csmString nstr(str.c_str(), str.length());
 	return Live2D::Cubism::Framework::CubismFramework::GetIdManager()->GetId(nstr);
 }
@@ -99,8 +109,73 @@ vec4 effect(vec4 color, Image tex, vec2 tc, vec2 sc)
 )";
 static int stencilFragRef = LUA_REFNIL;
 
+// Clipping with mask canvas. clipMatrix transforms model position to mask
+// canvas coordinates, clipRect is the mask region in the mask canvas, and
+// clipChannel selects the channel of the mask. Alpha only is multiplied by
+// the mask unless clipPremultiplied is 1.
+static const char clipShader[] = R"(
+varying vec2 clipPos;
+
+#ifdef VERTEX
+uniform vec4 clipMatrix;
+
+vec4 position(mat4 transform_projection, vec4 vertex_position)
+{
+	clipPos = vertex_position.xy * clipMatrix.xy + clipMatrix.zw;
+	return transform_projection * vertex_position;
+}
+#endif
+
+#ifdef PIXEL
+uniform Image clipMask;
+uniform vec4 clipRect;
+uniform vec4 clipChannel;
+uniform float clipPremultiplied;
+
+vec4 effect(vec4 color, Image tex, vec2 tc, vec2 sc)
+{
+	vec4 c = Texel(tex, tc) * color;
+	vec2 inside = step(clipRect.xy, clipPos) * step(clipPos, clipRect.zw);
+	float m = dot(Texel(clipMask, clipPos), clipChannel) * inside.x * inside.y;
+	return c * vec4(vec3(mix(1.0, m, clipPremultiplied)), m);
+}
+#endif
+)";
+static int clipShaderRef = LUA_REFNIL;
+// Reused table for Shader:send vec4
+static int clipVectorRef = LUA_REFNIL;
+
+// Instanced drawing. InstanceX and InstanceY are the rows of the affine
+// transformation of the instance, and InstanceColor is its tint. Instances
+// not in instanceGroup are moved outside of the clip space, unless it's
+// negative.
+static const char instanceVertex[] = R"(
+attribute vec3 InstanceX;
+attribute vec3 InstanceY;
+attribute float InstanceGroup;
+attribute vec4 InstanceColor;
+uniform float instanceGroup;
+
+vec4 position(mat4 transform_projection, vec4 vertex_position)
+{
+	if (instanceGroup >= 0.0 && InstanceGroup != instanceGroup)
+		return vec4(2.0, 2.0, 2.0, 1.0);
+
+	vec3 p = vec3(vertex_position.xy, 1.0);
+	VaryingColor *= InstanceColor;
+	return transform_projection * vec4(dot(InstanceX, p), dot(InstanceY, p), vertex_position.zw);
+}
+)";
+static int instanceShaderRef = LUA_REFNIL;
+// Same as above, but for drawing masks to the stencil buffer
+static int instanceStencilShaderRef = LUA_REFNIL;
+
 Live2LOVE::glBlendFuncSeparate_t Live2LOVE::glBlendFuncSeparate = nullptr;
 bool Live2LOVE::glBlendFuncSeparateAttempted = false;
+std::atomic<bool> Live2LOVE::doubleUpdate(false);
+
+// Simulation tasks submitted to the thread pool, possibly still running
+static std::set<ThreadPoolTask*> submittedSimulations;
 
 static Live2LOVE::glBlendFuncSeparate_t loadBlendFunc(lua_State *L = nullptr)
 {
@@ -156,7 +231,7 @@ return namespace._LIVE2LOVE_GL_GET_PROC_ADDRESS("glBlendFuncSeparate")
 	return f;
 }
 
-// Sort operator, for std::sort
+// Sort operator, for std::stable_sort
 static bool compareDrawOrder(const Live2LOVEMesh *a, const Live2LOVEMesh *b)
 {
 	return a->renderOrder < b->renderOrder;
@@ -171,7 +246,7 @@ template<class T> T* createData(lua_State *L, size_t amount)
 	T *val = nullptr;
 
 	// New file data
-	RefData::getRef(L, "love.data.newByteData");
+	RefData::getRef(L, RefData::LOVE_DATA_NEWBYTEDATA);
 	lua_pushinteger(L, memalloc);
 	lua_call(L, 1, 1);
 
@@ -205,6 +280,19 @@ template<class T> T* createData(lua_State *L, size_t amount)
 	return val;
 }
 
+// Same transformation as love.graphics.draw. x' = m[0] * x + m[2] * y + m[4]
+// and y' = m[1] * x + m[3] * y + m[5].
+static void getDrawMatrix(const Live2LOVE::DrawCoordinates &di, double *m)
+{
+	double c = cos(di.r), s = sin(di.r);
+	m[0] = c * di.sx - di.ky * s * di.sy;
+	m[1] = s * di.sx + di.ky * c * di.sy;
+	m[2] = di.kx * c * di.sx - s * di.sy;
+	m[3] = di.kx * s * di.sx + c * di.sy;
+	m[4] = di.x - di.ox * m[0] - di.oy * m[2];
+	m[5] = di.y - di.ox * m[1] - di.oy * m[3];
+}
+
 // +9 at Lua stack
 inline void pushDrawCoordinates(lua_State *L, const Live2LOVE::DrawCoordinates &di)
 {
@@ -219,8 +307,25 @@ inline void pushDrawCoordinates(lua_State *L, const Live2LOVE::DrawCoordinates &
 	lua_pushnumber(L, di.ky);
 }
 
-Live2LOVE::Live2LOVE(lua_State *L, const void *buf, size_t size)
-: moc(nullptr)
+std::shared_ptr<CubismMoc> Live2LOVE::createMoc(const void *buf, size_t size)
+{
+	CubismMoc *moc = CubismMoc::Create((csmByte *) buf, size);
+	if (moc == nullptr)
+		throw NamedException("Failed to initialize moc");
+
+	// Deleted after the last model using it
+	return std::shared_ptr<CubismMoc>(moc, CubismMoc::Delete);
+}
+
+Live2LOVE::Live2LOVE(lua_State *L, const void *buf, size_t size, MeshModeID meshMode)
+: Live2LOVE(L, createMoc(buf, size), nullptr, meshMode)
+{
+}
+
+Live2LOVE::Live2LOVE(lua_State *L, std::shared_ptr<CubismMoc> sharedMoc, std::shared_ptr<UVData> sharedUV, MeshModeID meshMode)
+: moc(sharedMoc)
+, uvData(sharedUV)
+, definition(std::make_shared<Definition>())
 , model(nullptr)
 , motion(nullptr)
 , expression(nullptr)
@@ -228,15 +333,57 @@ Live2LOVE::Live2LOVE(lua_State *L, const void *buf, size_t size)
 , physics(nullptr)
 , breath(nullptr)
 , pose(nullptr)
+, drawOrderChanged(false)
+, meshMode(meshMode)
+, sharedMeshRefID(LUA_NOREF)
+, sharedTableRefID(LUA_NOREF)
+, sharedTablePointer(nullptr)
+, sharedTextureRefID(LUA_NOREF)
 , L(L)
 , movementAnimation(true)
 , eyeBlinkMovement(true)
 , motionLoop("")
+, forceMeshUpdate(true)
+, dirtyStart(INT_MAX)
+, dirtyEnd(0)
+, uploadViewRefID(LUA_NOREF)
+, uploadViewStart(0)
+, uploadViewEnd(0)
+, stats()
+, nextStats()
+, pipelined(false)
+, fixedTimestep(0)
+, maxSubsteps(0)
+, timeAccumulator(0)
+, stepped(false)
+, updateInterval(1)
+, frameCounter(0)
+, autoIntervalScale(0)
+, drawScale(1.0f)
+, cullEnabled(false)
+, hasMaskCommands(false)
+, batching(false)
+, maskSets()
+, clipMode(CLIP_STENCIL)
+, maskCanvasSize(0)
+, maskCanvasRefID(LUA_NOREF)
+, hasClipCommands(false)
+, hasBlendCommands(false)
+, renderCache(false)
+, cacheCanvasRefID(LUA_NOREF)
+, cacheCanvasSize {0, 0}
+, cacheValid(false)
+, cacheScale(0)
+, cacheOrigin {0, 0}
+, instanceMeshRefID(LUA_NOREF)
+, instanceTableRefID(LUA_NOREF)
+, instanceTablePointer(nullptr)
+, instanceCapacity(0)
 {
 	// initialize clip fragment shader
 	if (stencilFragRef == LUA_REFNIL)
 	{
-		RefData::getRef(L, "love.graphics.newShader");
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWSHADER);
 		lua_pushstring(L, stencilFragment);
 		lua_pcall(L, 1, 1, 0);
 		if (lua_toboolean(L, -2) == 0)
@@ -256,12 +403,8 @@ Live2LOVE::Live2LOVE(lua_State *L, const void *buf, size_t size)
 		glBlendFuncSeparateAttempted = true;
 	}
 
-	// Init moc
-	moc = CubismMoc::Create((csmByte *) buf, size);
-	if (moc == nullptr)
-		throw NamedException("Failed to initialize moc");
-
-	// Init model
+	// Init model. This registers IDs of the model.
+	waitAllSimulations();
 	model = moc->CreateModel();
 	if (model == nullptr)
 		throw NamedException("Failed to intialize model");
@@ -282,13 +425,30 @@ Live2LOVE::Live2LOVE(lua_State *L, const void *buf, size_t size)
 	// Setup mesh data
 	setupMeshData();
 
+	// Preallocate post-update parameter queue
+	postParamSlot.resize(model->GetParameterCount(), -1);
+	postParamUpdateList.reserve(model->GetParameterCount());
+
 	// Initialize default eye and breath
 	loadEyeBlink();
 	loadBreath();
+
+	simulationTask.owner = this;
+	simulationTask.deltaT = 0;
+
+	// Bounds of the initial pose, so masks, culling, and render cache work
+	// before the first update
+	updateVisibilityInfo();
+	std::copy(nextBounds, nextBounds + 4, bounds);
+	updateMaskSets();
 }
 
 Live2LOVE::~Live2LOVE()
 {
+	// Exceptions can't leave destructor
+	ThreadPool::wait(&simulationTask);
+	submittedSimulations.erase(&simulationTask);
+
 	// Delete all mesh
 	for (auto mesh: meshData)
 	{
@@ -297,6 +457,23 @@ Live2LOVE::~Live2LOVE()
 		delete mesh;
 	}
 
+	// Delete mask and cache canvas
+	RefData::delRef(L, maskCanvasRefID);
+	RefData::delRef(L, cacheCanvasRefID);
+
+	// Delete instance attributes
+	RefData::delRef(L, instanceMeshRefID);
+	RefData::delRef(L, instanceTableRefID);
+
+	// Delete shared mesh and textures
+	RefData::delRef(L, uploadViewRefID);
+	RefData::delRef(L, sharedTableRefID);
+	RefData::delRef(L, sharedMeshRefID);
+	for (int ref: textureRefID)
+		RefData::delRef(L, ref);
+	for (int ref: pmaTextureRefID)
+		RefData::delRef(L, ref);
+
 	// Delete all motions
 	for (auto motion: motionList)
 		CubismMotion::Delete(motion.second);
@@ -305,20 +482,114 @@ Live2LOVE::~Live2LOVE()
 	for (auto exprs: expressionList)
 		CubismExpressionMotion::Delete(exprs.second);
 
+	// Moc, UV and definition are deleted when no clone uses them
 	CSM_DELETE(motion);
 	CSM_DELETE(expression);
 	CubismBreath::Delete(breath);
 	CubismEyeBlink::Delete(eyeBlink);
 	CubismPhysics::Delete(physics);
+	if (pose)
+		CubismPose::Delete(pose);
 	moc->DeleteModel(model);
-	CubismMoc::Delete(moc);
 }
 
-void Live2LOVE::setupMeshData()
+Live2LOVE::UVData::~UVData()
 {
-	// Check stack
-	lua_checkstack(L, 64);
+	for (int ref: meshRefID)
+		RefData::delRef(L, ref);
+}
+
+Live2LOVE *Live2LOVE::clone() const
+{
+	waitSimulation();
+
+	// New model from the same moc and UV, with default parameters
+	std::unique_ptr<Live2LOVE> l2l(new Live2LOVE(L, moc, uvData, meshMode));
+
+	// Share textures
+	if (meshMode == MESH_SHARED)
+	{
+		for (size_t i = 0; i < textureRefID.size(); i++)
+		{
+			if (textureRefID[i] != LUA_REFNIL)
+			{
+				RefData::getRef(L, textureRefID[i]);
+				l2l->textureRefID[i] = RefData::setRef(L, -1);
+				lua_pop(L, 1);
+			}
+
+			if (pmaTextureRefID[i] != LUA_REFNIL)
+			{
+				RefData::getRef(L, pmaTextureRefID[i]);
+				l2l->pmaTextureRefID[i] = RefData::setRef(L, -1);
+				lua_pop(L, 1);
+			}
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < meshData.size(); i++)
+		{
+			// Call clone Mesh:setTexture(Mesh:getTexture())
+			RefData::getRef(L, l2l->meshData[i]->meshRefID);
+			lua_getfield(L, -1, "setTexture");
+			lua_insert(L, -2);
+			RefData::getRef(L, meshData[i]->meshRefID);
+			lua_getfield(L, -1, "getTexture");
+			lua_insert(L, -2);
+			lua_call(L, 1, 1);
+			lua_call(L, 2, 0);
+		}
+	}
+
+	// Motions and expressions are parsed when the clone starts them.
+	// Physics and pose are used by every update, so parse them now.
+	l2l->definition = definition;
+	if (!definition->motions.empty())
+		l2l->initializeMotion();
+	if (!definition->expressions.empty())
+		l2l->initializeExpression();
+
+	if (definition->physics)
+	{
+		const std::string &json = *definition->physics;
+		l2l->physics = CubismPhysics::Create((csmByte *) json.data(), json.size());
+		if (l2l->physics == nullptr)
+			throw NamedException("Failed to load physics");
+	}
+
+	if (definition->pose)
+	{
+		const std::string &json = *definition->pose;
+		l2l->pose = CubismPose::Create((csmByte *) json.data(), json.size());
+		if (l2l->pose == nullptr)
+			throw NamedException("Failed to load pose");
+	}
 
+	if (eyeBlink)
+		l2l->eyeBlink->SetParameterIds(eyeBlink->GetParameterIds());
+	if (breath)
+		l2l->breath->SetParameters(breath->GetParameters());
+
+	// Copy settings
+	l2l->movementAnimation = movementAnimation;
+	l2l->eyeBlinkMovement = eyeBlinkMovement;
+	l2l->pipelined = pipelined;
+	l2l->fixedTimestep = fixedTimestep;
+	l2l->maxSubsteps = maxSubsteps;
+	l2l->updateInterval = updateInterval;
+	l2l->autoIntervalScale = autoIntervalScale;
+	l2l->cullEnabled = cullEnabled;
+	std::copy(cullRect, cullRect + 4, l2l->cullRect);
+	l2l->renderCache = renderCache;
+	l2l->batching = batching;
+	l2l->setClippingMode(clipMode, clipMode == CLIP_CANVAS ? maskCanvasSize : 512);
+
+	return l2l.release();
+}
+
+void Live2LOVE::setupMeshData()
+{
 	// Get drawable count
 	int drawableCount = model->GetDrawableCount();
 	meshData.reserve(drawableCount);
@@ -326,9 +597,9 @@ void Live2LOVE::setupMeshData()
 	// Get render order
 	const csmInt32 *renderOrders = model->GetDrawableRenderOrders();
 
-	// Push newMesh
-	RefData::getRef(L, "love.graphics.newMesh");
-	
+	// Total vertices and indices, used for shared mesh
+	int vertexCount = 0, indexCount = 0;
+
 	// Load mesh
 	for (int i = 0; i < drawableCount; i++)
 	{	
@@ -339,6 +610,20 @@ void Live2LOVE::setupMeshData()
 		mesh->textureIndex = model->GetDrawableTextureIndices(i);
 		mesh->blending = model->GetDrawableBlendMode(i);
 		mesh->renderOrder = renderOrders[i];
+		mesh->numPoints = model->GetDrawableVertexCount(i);
+		mesh->indexCount = model->GetDrawableVertexIndexCount(i);
+		mesh->vertexOffset = vertexCount;
+		mesh->indexOffset = indexCount;
+		mesh->meshRefID = mesh->tableRefID = LUA_NOREF;
+		mesh->tablePointer = nullptr;
+		mesh->needUpload = false;
+		mesh->interpolate = mesh->stateChanged = false;
+		mesh->visible = true;
+		mesh->isMask = mesh->positionStale = false;
+		mesh->maskSet = -1;
+		clearBounds(mesh->bounds);
+		vertexCount += mesh->numPoints;
+		indexCount += mesh->indexCount;
 
 		// Check PMA texture requirement
 		if (mesh->textureIndex >= needPMATexture.size())
@@ -348,55 +633,25 @@ void Live2LOVE::setupMeshData()
 		if (mesh->blending == MultiplyBlending)
 			needPMATexture[mesh->textureIndex] = true;
 
-		// Create mesh table list
-		int numPoints = mesh->numPoints = model->GetDrawableVertexCount(i);
-		int indexCount = model->GetDrawableVertexIndexCount(i);
-		const csmUint16 *vertexMap = model->GetDrawableVertexIndices(i);
-		const csmVector2 *uvmap = model->GetDrawableVertexUvs(i);
-		const csmVector2 *points = model->GetDrawableVertexPositions(i);
-		
-		// Build mesh
-		lua_pushvalue(L, -1); // love.graphics.newMesh
-		lua_pushinteger(L, numPoints);
-		lua_pushstring(L, "triangles"); // Mesh draw mode
-		lua_pushstring(L, "stream"); // Mesh usage
-		lua_call(L, 3, 1); // love.graphics.newMesh
-		mesh->meshRefID = RefData::setRef(L, -1); // Add mesh reference
-
-		// Set index map
-		lua_getfield(L, -1, "setVertexMap");
-		lua_pushvalue(L, -2);
-		csmUint16 *tempMap = createData<csmUint16>(L, indexCount);
-		memcpy(tempMap, vertexMap, indexCount * sizeof(csmUint16));
-		lua_pushstring(L, "uint16");
-		lua_call(L, 3, 0); // tempMap is no longer valid
-
-		// Pop the Mesh object
-		lua_pop(L, 1);
-		
-		Live2LOVEMeshFormat *meshDataRaw = createData<Live2LOVEMeshFormat>(L, numPoints);
-		for (int j = 0; j < numPoints; j++)
-		{
-			Live2LOVEMeshFormat& m = meshDataRaw[j];
-			// Mesh table format: {x, y, u, v, r, g, b, a}
-			// r, g, b will be 1
-			// Textures in OpenGL are flipped but aren't in LOVE so the Y position is flipped
-			// to take that into account.
-			m.x = points[j].X * modelPixelUnits + modelOffX;
-			m.y = points[j].Y * -modelPixelUnits + modelOffY;
-			m.u = uvmap[j].X;
-			m.v = 1.0f - uvmap[j].Y;
-			m.r = m.g = m.b = m.a = 255; // set later
-		}
-		mesh->tableRefID = RefData::setRef(L, -1); // Add FileData reference
-		mesh->tablePointer = meshDataRaw;
-		lua_pop(L, 1); // pop the FileData reference
-
 		// Push to vector
 		meshData.push_back(mesh);
 		meshDataMap[fromCsmString(model->GetDrawableId(i)->GetString())] = mesh;
 	}
 
+	// Initial draw order
+	nextDrawOrder.resize(drawableCount);
+	updateDrawOrder();
+
+	// Texture coordinates are loaded once, and shared with clones
+	if (!uvData)
+		setupUVData(vertexCount);
+
+	// Create LOVE Mesh objects
+	if (meshMode == MESH_SHARED)
+		setupSharedMeshData(vertexCount, indexCount);
+	else
+		setupSeparateMeshData();
+
 	const csmInt32 *clipCount = model->GetDrawableMaskCounts();
 	const csmInt32 **clipMask = model->GetDrawableMasks();
 
@@ -408,272 +663,1815 @@ void Live2LOVE::setupMeshData()
 		if (clipCount[i] > 0)
 		{
 			for (unsigned int k = 0; k < clipCount[i]; k++)
+			{
 				mesh->clipID.push_back(meshData[clipMask[i][k]]);
+				meshData[clipMask[i][k]]->isMask = true;
+			}
 		}
 	}
+
+	setupMaskSets();
+
+	// Initial draw commands
+	publishDrawOrder();
 }
 
-void Live2LOVE::update(double dt)
+void Live2LOVE::setupMaskSets()
 {
-	// Motion update
-	if (motion)
+	// Group drawables by identical mask list. Mask order doesn't matter.
+	std::map<std::vector<Live2LOVEMesh*>, int> setIndex;
+
+	for (auto mesh: meshData)
 	{
-		model->LoadParameters();
-		if (motion->IsFinished() && motionLoop.length() > 0)
-			// Revert
-			motion->StartMotion(motionList[motionLoop], false, 1.0f);
+		if (mesh->clipID.empty())
+			continue;
 
-		if (!motion->UpdateMotion(model, dt) && movementAnimation)
+		std::vector<Live2LOVEMesh*> key = mesh->clipID;
+		std::sort(key.begin(), key.end(), [](const Live2LOVEMesh *a, const Live2LOVEMesh *b)
 		{
-			if (eyeBlink && eyeBlinkMovement)
-				// Update eye blink
-				eyeBlink->UpdateParameters(model, dt);
+			return a->index < b->index;
+		});
+
+		auto it = setIndex.find(key);
+		if (it == setIndex.end())
+		{
+			Live2LOVEMaskSet maskSet;
+			maskSet.masks = key;
+			it = setIndex.insert(std::make_pair(key, (int) maskSets.size())).first;
+			maskSets.push_back(maskSet);
 		}
-		model->SaveParameters();
+
+		mesh->maskSet = it->second;
 	}
 
-	// Expression update
-	if (expression)
-		expression->UpdateMotion(model, dt);
+	// Assign mask canvas channel and region. Each channel is divided to
+	// same amount of regions, up to 3x3.
+	int setCount = (int) maskSets.size();
+	int perChannel = std::min((setCount + 3) / 4, 9);
+	int gridX = perChannel <= 1 ? 1 : (perChannel <= 4 ? 2 : 3);
+	int gridY = perChannel <= 2 ? 1 : (perChannel <= 4 ? 2 : 3);
 
-	// Movement update
-	if (movementAnimation)
+	for (int i = 0; i < setCount; i++)
 	{
-		// Breath update
-		if (breath)
-			breath->UpdateParameters(model, dt);
-
-		// Physics update
-		if (physics)
-			physics->Evaluate(model, dt);
+		Live2LOVEMaskSet &maskSet = maskSets[i];
+		int region = i / 4;
+
+		// Sets which don't fit use stencil
+		maskSet.channel = region < perChannel ? (i % 4) : -1;
+		maskSet.region[0] = (float) (region % gridX) / gridX;
+		maskSet.region[1] = (float) (region / gridX) / gridY;
+		maskSet.region[2] = 1.0f / gridX;
+		maskSet.region[3] = 1.0f / gridY;
+		maskSet.transform[0] = maskSet.transform[1] = maskSet.transform[2] = maskSet.transform[3] = 0.0f;
+		clearBounds(maskSet.bounds);
+		maskSet.empty = true;
+
+		// Amount of stencil values needed by nested masks
+		maskSet.depth = 0;
+		for (Live2LOVEMesh *mask: maskSet.masks)
+			maskSet.depth = std::max(maskSet.depth, getStencilDepth(mask));
 	}
+}
 
-	if (pose)
-		pose->UpdateParameters(model, dt);
+int Live2LOVE::getStencilDepth(Live2LOVEMesh *mesh)
+{
+	int depth = 0;
+	for (Live2LOVEMesh *x: mesh->clipID)
+		depth = std::max(depth, getStencilDepth(x));
 
-	model->Update();
+	return depth + 1;
+}
 
-	// If there's parameter change, set it
-	for (auto& list: postParamUpdateList)
+void Live2LOVE::updateMaskSets()
+{
+	const float size = (float) maskCanvasSize;
+	const float padding = 2.0f;
+
+	for (Live2LOVEMaskSet &maskSet: maskSets)
 	{
-		const CubismId *paramName = toCsmString(list.first);
-		model->SetParameterValue(model->GetParameterIndex(paramName), list.second->first, list.second->second);
+		float *bounds = maskSet.bounds;
+		clearBounds(bounds);
+
+		for (auto mask: maskSet.masks)
+		{
+			bounds[0] = std::min(bounds[0], mask->bounds[0]);
+			bounds[1] = std::min(bounds[1], mask->bounds[1]);
+			bounds[2] = std::max(bounds[2], mask->bounds[2]);
+			bounds[3] = std::max(bounds[3], mask->bounds[3]);
+		}
 
-		delete list.second;
-		list.second = nullptr;
+		maskSet.empty = bounds[0] > bounds[2] || bounds[1] > bounds[3];
+		if (maskSet.empty || clipMode != CLIP_CANVAS)
+			continue;
+
+		// Fit mask bounds to the region, in pixels
+		float x = maskSet.region[0] * size + padding;
+		float y = maskSet.region[1] * size + padding;
+		float w = maskSet.region[2] * size - padding * 2.0f;
+		float h = maskSet.region[3] * size - padding * 2.0f;
+		float sx = w / std::max(bounds[2] - bounds[0], 1e-3f);
+		float sy = h / std::max(bounds[3] - bounds[1], 1e-3f);
+
+		// Model position to mask canvas pixel: (p - min) * s + xy
+		maskSet.transform[0] = sx;
+		maskSet.transform[1] = sy;
+		maskSet.transform[2] = x - bounds[0] * sx;
+		maskSet.transform[3] = y - bounds[1] * sy;
 	}
-	postParamUpdateList.clear();
+}
 
-	// Update model
-	model->Update();
+// Push Mesh vertex format table {{name, type, components}, ...}. +1 at Lua
+// stack
+static void pushMeshFormat(lua_State *L, const char *const *names, const char *const *types, const int *sizes, int count)
+{
+	lua_createtable(L, count, 0);
+
+	for (int i = 0; i < count; i++)
+	{
+		lua_createtable(L, 3, 0);
+		lua_pushstring(L, names[i]);
+		lua_rawseti(L, -2, 1);
+		lua_pushstring(L, types[i]);
+		lua_rawseti(L, -2, 2);
+		lua_pushinteger(L, sizes[i]);
+		lua_rawseti(L, -2, 3);
+		lua_rawseti(L, -2, i + 1);
+	}
+}
 
-	// Get render orders
-	auto renderOrders = model->GetDrawableRenderOrders();
+// Fill vertex data of the drawable with its initial position, and store
+// bounding box of the positions to bounds
+static void initializeVertices(Live2LOVEMeshFormat *meshDataRaw, const csmVector2 *points, int numPoints, float pixelUnits, float offX, float offY, float *bounds)
+{
+	// Textures in OpenGL are flipped but aren't in LOVE so the Y position is flipped
+	// to take that into account.
+	VertexKernel::transform(meshDataRaw, points, numPoints, pixelUnits, offX, offY, bounds);
 
-	// Update mesh data
-	for (auto mesh: meshData)
+	for (int j = 0; j < numPoints; j++)
 	{
-		// Set render order
-		mesh->renderOrder = renderOrders[mesh->index];
+		Live2LOVEMeshFormat& m = meshDataRaw[j];
+		// Mesh table format: {x, y, r, g, b, a}
+		// r, g, b will be 1
+		m.r = m.g = m.b = m.a = 255; // set later
+	}
+}
 
-		// Get mesh ref
-		RefData::getRef(L, mesh->meshRefID);
+void Live2LOVE::setupUVData(int vertexCount)
+{
+	static const char *names[1] = {"VertexTexCoord"};
+	static const char *types[1] = {"float"};
+	static const int sizes[1] = {2};
 
-		// Get "setVertices"
-		lua_getfield(L, -1, "setVertices");
-		lua_pushvalue(L, -2);
+	// Check stack
+	lua_checkstack(L, 64);
 
-		// Get data mesh ref
-		RefData::getRef(L, mesh->tableRefID);
+	uvData = std::make_shared<UVData>();
+	uvData->L = L;
 
-		// Get opacity and new points
-		float visibility = model->GetDrawableDynamicFlagIsVisible(mesh->index) ? 1.0f : 0.0f;
-		float opacity = visibility * model->GetDrawableOpacity(mesh->index);
-		const csmVector2 *points = model->GetDrawableVertexPositions(mesh->index);
+	// One UV Mesh for all drawables, placed at their vertex offset
+	bool shared = meshMode == MESH_SHARED;
+	size_t meshCount = shared ? 1 : meshData.size();
 
-		// Update
-		if (mesh->blending == MultiplyBlending)
-		{
-			for (int i = 0; i < mesh->numPoints; i++)
-			{
-				Live2LOVEMeshFormat& m = mesh->tablePointer[i];
-				m.x = points[i].X * modelPixelUnits + modelOffX;
-				m.y = points[i].Y * -modelPixelUnits + modelOffY;
-				m.r = m.g = m.b = m.a = (unsigned char) floor(opacity * 255.0f + 0.5f);
-			}
-		}
-		else
+	for (size_t i = 0; i < meshCount; i++)
+	{
+		int count = shared ? vertexCount : meshData[i]->numPoints;
+		const std::vector<Live2LOVEMesh*> meshes = shared ? meshData : std::vector<Live2LOVEMesh*> {meshData[i]};
+
+		// Call love.graphics.newMesh(format, count, "triangles", "static")
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWMESH);
+		pushMeshFormat(L, names, types, sizes, 1);
+		lua_pushinteger(L, count);
+		lua_pushstring(L, "triangles"); // Mesh draw mode
+		lua_pushstring(L, "static"); // Mesh usage
+		lua_call(L, 4, 1);
+		uvData->meshRefID.push_back(RefData::setRef(L, -1));
+
+		lua_getfield(L, -1, "setVertices");
+		lua_pushvalue(L, -2);
+		float *uv = createData<float>(L, count * 2);
+
+		for (const Live2LOVEMesh *mesh: meshes)
 		{
-			for (int i = 0; i < mesh->numPoints; i++)
+			const csmVector2 *uvmap = model->GetDrawableVertexUvs(mesh->index);
+			float *dest = uv + (shared ? mesh->vertexOffset * 2 : 0);
+
+			// Textures in OpenGL are flipped but aren't in LOVE so the V
+			// coordinate is flipped to take that into account.
+			for (int k = 0; k < mesh->numPoints; k++)
 			{
-				Live2LOVEMeshFormat& m = mesh->tablePointer[i];
-				m.x = points[i].X * modelPixelUnits + modelOffX;
-				m.y = points[i].Y * -modelPixelUnits + modelOffY;
-				m.a = (unsigned char) floor(opacity * 255.0f + 0.5f);
+				dest[k * 2] = uvmap[k].X;
+				dest[k * 2 + 1] = 1.0f - uvmap[k].Y;
 			}
 		}
 
-		// Call setVertices
-		lua_call(L, 2, 0);
+		lua_call(L, 2, 0); // uv is no longer valid
 
-		// Pop Mesh object
+		// Pop the UV Mesh
 		lua_pop(L, 1);
 	}
-	// Update draw order
-	std::sort(meshData.begin(), meshData.end(), compareDrawOrder);
 }
 
-void Live2LOVE::draw(double x, double y, double r, double sx, double sy, double ox, double oy, double kx, double ky)
+void Live2LOVE::pushNewMesh(int vertexCount, int uvIndex)
 {
-	if (!lua_checkstack(L, lua_gettop(L) + 24))
-		throw NamedException("Internal error: cannot grow Lua stack size");
+	static const char *names[2] = {"VertexPosition", "VertexColor"};
+	static const char *types[2] = {"float", "byte"};
+	static const int sizes[2] = {2, 4};
+
+	// Call love.graphics.newMesh(format, vertexCount, "triangles", "stream")
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWMESH);
+	pushMeshFormat(L, names, types, sizes, 2);
+	lua_pushinteger(L, vertexCount);
+	lua_pushstring(L, "triangles"); // Mesh draw mode
+	lua_pushstring(L, "stream"); // Mesh usage
+	lua_call(L, 4, 1);
+
+	// Call Mesh:attachAttribute("VertexTexCoord", uvMesh)
+	lua_getfield(L, -1, "attachAttribute");
+	lua_pushvalue(L, -2);
+	lua_pushstring(L, "VertexTexCoord");
+	RefData::getRef(L, uvData->meshRefID[uvIndex]);
+	lua_call(L, 3, 0);
+}
 
-	// Save blending
-	RefData::getRef(L, "love.graphics.setBlendMode");
-	RefData::getRef(L, "love.graphics.getBlendMode");
-	lua_call(L, 0, 2);
+void Live2LOVE::setupSeparateMeshData()
+{
+	// Check stack
+	lua_checkstack(L, 64);
 
-	// Set blending mode to alpha,alphamultiply
-	lua_pushvalue(L, -3);
-	lua_pushstring(L, "alpha");
-	lua_pushstring(L, "alphamultiply");
-	lua_call(L, 2, 0);
+	for (Live2LOVEMesh *mesh: meshData)
+	{
+		int i = mesh->index;
+		int numPoints = mesh->numPoints;
+		int indexCount = mesh->indexCount;
+		const csmUint16 *vertexMap = model->GetDrawableVertexIndices(i);
+		const csmVector2 *points = model->GetDrawableVertexPositions(i);
+		
+		// Build mesh
+		pushNewMesh(numPoints, i);
+		mesh->meshRefID = RefData::setRef(L, -1); // Add mesh reference
 
-	// Clear stencil buffer
-	RefData::getRef(L, "love.graphics.clear");
-	lua_pushboolean(L, 0);
-	lua_pushinteger(L, 255);
-	lua_call(L, 2, 0);
+		// Set index map
+		lua_getfield(L, -1, "setVertexMap");
+		lua_pushvalue(L, -2);
+		csmUint16 *tempMap = createData<csmUint16>(L, indexCount);
+		memcpy(tempMap, vertexMap, indexCount * sizeof(csmUint16));
+		lua_pushstring(L, "uint16");
+		lua_call(L, 3, 0); // tempMap is no longer valid
 
-	// Blending mode
-	auto blendMode = NormalBlending; // alpha,alphamultiply
+		// Pop the Mesh object
+		lua_pop(L, 1);
+		
+		Live2LOVEMeshFormat *meshDataRaw = createData<Live2LOVEMeshFormat>(L, numPoints);
+		initializeVertices(meshDataRaw, points, numPoints, modelPixelUnits, modelOffX, modelOffY, mesh->bounds);
+		mesh->tableRefID = RefData::setRef(L, -1); // Add FileData reference
+		mesh->tablePointer = meshDataRaw;
+		lua_pop(L, 1); // pop the FileData reference
+	}
+}
 
-	// Get love.graphics.draw
-	RefData::getRef(L, "love.graphics.draw");
+template<class T> static void buildSharedVertexMap(lua_State *L, const std::vector<Live2LOVEMesh*> &order, int indexCount, const char *type)
+{
+	// Set index map, offset by the drawable vertex position in the shared mesh.
+	// Indices are placed in the specified drawable order.
+	// Shared Mesh object is at -3, setVertexMap at -2, and Mesh object again at -1
+	T *tempMap = createData<T>(L, indexCount);
+	int indexOffset = 0;
 
-	// List mesh data
-	for (auto mesh: meshData)
+	for (Live2LOVEMesh *mesh: order)
 	{
-		bool stencilSet = false;
-		// If there's clip ID, draw stencil first.
-		if (mesh->clipID.size() > 0)
-		{
-			// Setup DrawCoordinates
-			DrawCoordinates drawInfo {x, y, r, sx, sy, ox, oy, kx, ky};
+		const csmUint16 *vertexMap = mesh->model->GetDrawableVertexIndices(mesh->index);
+		T *dest = tempMap + indexOffset;
 
-			// Backup shader
-			RefData::getRef(L, "love.graphics.getShader");
-			lua_call(L, 0, 1);
+		for (int j = 0; j < mesh->indexCount; j++)
+			dest[j] = (T) (vertexMap[j] + mesh->vertexOffset);
 
-			RefData::getRef(L, "love.graphics.setShader");
-			RefData::getRef(L, stencilFragRef);
-			lua_call(L, 1, 0);
+		mesh->indexOffset = indexOffset;
+		indexOffset += mesh->indexCount;
+	}
 
-			// Draw stencil main loop
-			stencilSet = true;
-			drawStencil(mesh, drawInfo, 1);
+	lua_pushstring(L, type);
+	lua_call(L, 3, 0); // tempMap is no longer valid
+}
 
-			// Call love.graphics.setStencilTest("equal", 1);
-			RefData::getRef(L, "love.graphics.setStencilTest");
-			lua_pushlstring(L, "equal", 5);
-			lua_pushinteger(L, 1);
-			lua_call(L, 2, 0);
+void Live2LOVE::updateVertexMap(const std::vector<Live2LOVEMesh*> &order)
+{
+	if (meshData.empty())
+		return;
+
+	const Live2LOVEMesh *last = meshData.back();
+	int vertexCount = last->vertexOffset + last->numPoints;
+	int indexCount = 0;
+
+	for (Live2LOVEMesh *mesh: order)
+		indexCount += mesh->indexCount;
+
+	RefData::getRef(L, sharedMeshRefID);
+	lua_getfield(L, -1, "setVertexMap");
+	lua_pushvalue(L, -2);
+
+	// uint16 can't address more than 65536 vertices.
+	if (vertexCount > 65536)
+		buildSharedVertexMap<csmUint32>(L, order, indexCount, "uint32");
+	else
+		buildSharedVertexMap<csmUint16>(L, order, indexCount, "uint16");
+
+	// Pop the Mesh object
+	lua_pop(L, 1);
+}
+
+void Live2LOVE::setupSharedMeshData(int vertexCount, int indexCount)
+{
+	// Check stack
+	lua_checkstack(L, 64);
+
+	// Build mesh
+	pushNewMesh(vertexCount, 0);
+	sharedMeshRefID = RefData::setRef(L, -1); // Add mesh reference
+	lua_pop(L, 1);
+
+	// Set index map in drawable order
+	updateVertexMap(meshData);
+
+	// Single vertex buffer for all drawables
+	sharedTablePointer = createData<Live2LOVEMeshFormat>(L, vertexCount);
+	for (Live2LOVEMesh *mesh: meshData)
+	{
+		int i = mesh->index;
+		mesh->tablePointer = sharedTablePointer + mesh->vertexOffset;
+		initializeVertices(
+			mesh->tablePointer,
+			model->GetDrawableVertexPositions(i),
+			mesh->numPoints,
+			modelPixelUnits, modelOffX, modelOffY,
+			mesh->bounds
+		);
+	}
+	sharedTableRefID = RefData::setRef(L, -1); // Add FileData reference
+	lua_pop(L, 1); // pop the FileData reference
+
+	// Textures are assigned on draw
+	textureRefID.resize(needPMATexture.size(), LUA_REFNIL);
+	pmaTextureRefID.resize(needPMATexture.size(), LUA_REFNIL);
+}
+
+void Live2LOVE::pushMesh(Live2LOVEMesh *mesh)
+{
+	pushMesh(mesh, mesh->indexOffset, mesh->indexCount);
+}
+
+void Live2LOVE::pushMesh(Live2LOVEMesh *mesh, int indexStart, int indexCount)
+{
+	if (meshMode != MESH_SHARED)
+	{
+		RefData::getRef(L, mesh->meshRefID);
+		return;
+	}
+
+	RefData::getRef(L, sharedMeshRefID);
+
+	// Switch texture if needed
+	int texRefID = mesh->blending == MultiplyBlending
+		? pmaTextureRefID[mesh->textureIndex]
+		: textureRefID[mesh->textureIndex];
+	if (texRefID != sharedTextureRefID)
+	{
+		lua_getfield(L, -1, "setTexture");
+		lua_pushvalue(L, -2);
+
+		if (texRefID == LUA_REFNIL)
+			lua_pushnil(L);
+		else
+			RefData::getRef(L, texRefID);
+
+		lua_call(L, 2, 0);
+		sharedTextureRefID = texRefID;
+	}
+
+	// Set draw range
+	lua_getfield(L, -1, "setDrawRange");
+	lua_pushvalue(L, -2);
+	lua_pushinteger(L, indexStart + 1);
+	lua_pushinteger(L, indexCount);
+	lua_call(L, 3, 0);
+}
+
+void Live2LOVE::update(double dt)
+{
+	if (pipelined)
+	{
+		// Publish last simulation result, then simulate next frame in background
+		waitSimulation();
+		upload();
+		simulationTask.deltaT = dt;
+		ThreadPool::getInstance()->submit(&simulationTask);
+		submittedSimulations.insert(&simulationTask);
+	}
+	else
+	{
+		simulate(dt);
+		upload();
+	}
+}
+
+void Live2LOVE::SimulationTask::run()
+{
+	try
+	{
+		owner->simulate(deltaT);
+	}
+	catch (std::exception &x)
+	{
+		error = x.what();
+	}
+}
+
+void Live2LOVE::waitSimulation() const
+{
+	ThreadPool::wait(&simulationTask);
+
+	if (!simulationTask.error.empty())
+	{
+		NamedException temp(simulationTask.error);
+		simulationTask.error.clear();
+		throw temp;
+	}
+}
+
+void Live2LOVE::waitAllSimulations()
+{
+	// Errors are kept for waitSimulation of the model
+	for (ThreadPoolTask *task: submittedSimulations)
+		ThreadPool::wait(task);
+
+	submittedSimulations.clear();
+}
+
+void Live2LOVE::setPipelined(bool p)
+{
+	waitSimulation();
+	pipelined = p;
+}
+
+bool Live2LOVE::isPipelined() const
+{
+	return pipelined;
+}
+
+void Live2LOVE::simulate(double dt)
+{
+	int interval = getUpdateInterval();
+	bool useSteps = fixedTimestep > 0.0 || interval > 1;
+
+	if (useSteps != stepped)
+	{
+		// Switching between stepped and direct update. Restart from
+		// current model state.
+		for (auto mesh: meshData)
+			mesh->interpolate = mesh->stateChanged = false;
+
+		stepped = useSteps;
+		forceMeshUpdate = true;
+	}
+
+	if (stepped)
+		simulateStepped(dt, interval);
+	else
+	{
+		updateParameters(dt);
+		clearPostParams();
+		updateVertices();
+	}
+}
+
+void Live2LOVE::simulateStepped(double dt, int interval)
+{
+	if (forceMeshUpdate)
+	{
+		// Previous and current simulation state to interpolate between
+		int vertexCount = meshData.empty() ? 0 : (meshData.back()->vertexOffset + meshData.back()->numPoints);
+		prevVertices.resize(vertexCount);
+		currVertices.resize(vertexCount);
+		prevOpacity.resize(meshData.size());
+		currOpacity.resize(meshData.size());
+
+		// Start from current parameters without advancing time
+		csmUpdateModel(model->GetModel());
+		captureState(true);
+		timeAccumulator = 0;
+		frameCounter = 0;
+		forceMeshUpdate = false;
+	}
+
+	timeAccumulator += dt;
+	int steps;
+	double stepTime;
+	float alpha;
+
+	if (fixedTimestep > 0.0)
+	{
+		steps = (int) (timeAccumulator / fixedTimestep);
+		stepTime = fixedTimestep;
+
+		if (steps > maxSubsteps)
+		{
+			// Can't keep up. Drop the excess time instead of spiraling.
+			steps = maxSubsteps;
+			timeAccumulator = fmod(timeAccumulator, fixedTimestep);
+		}
+		else
+			timeAccumulator -= steps * fixedTimestep;
+
+		alpha = (float) (timeAccumulator / fixedTimestep);
+	}
+	else
+	{
+		// Simulate once every interval updates with the elapsed time
+		steps = ++frameCounter >= interval ? 1 : 0;
+		stepTime = timeAccumulator;
+
+		if (steps > 0)
+		{
+			frameCounter = 0;
+			timeAccumulator = 0;
+		}
+
+		alpha = (float) frameCounter / (float) interval;
+	}
+
+	for (int i = 0; i < steps; i++)
+	{
+		updateParameters(stepTime);
+		captureState(false);
+	}
+
+	// Post-update parameters are applied on every step of this update. They
+	// only take effect on simulated steps, so they are dropped by updates
+	// which don't simulate rather than mixed into a later update.
+	clearPostParams();
+
+	updateInterpolatedVertices(alpha);
+}
+
+void Live2LOVE::restartStepState()
+{
+	// Restart from current model state. This also reallocates the step
+	// buffers freed by releaseStepState.
+	for (auto mesh: meshData)
+		mesh->interpolate = mesh->stateChanged = false;
+
+	forceMeshUpdate = true;
+}
+
+void Live2LOVE::releaseStepState()
+{
+	if (fixedTimestep > 0.0 || updateInterval > 1 || autoIntervalScale > 0.0)
+		return;
+
+	std::vector<csmVector2>().swap(prevVertices);
+	std::vector<csmVector2>().swap(currVertices);
+	std::vector<csmVector2>().swap(lerpVertices);
+	std::vector<float>().swap(prevOpacity);
+	std::vector<float>().swap(currOpacity);
+}
+
+void Live2LOVE::setSimulationRate(double rate, int substeps)
+{
+	waitSimulation();
+
+	if (rate > 0.0)
+	{
+		fixedTimestep = 1.0 / rate;
+		maxSubsteps = std::max(substeps, 1);
+	}
+	else
+	{
+		fixedTimestep = 0.0;
+		maxSubsteps = 0;
+		releaseStepState();
+	}
+
+	restartStepState();
+}
+
+std::pair<double, int> Live2LOVE::getSimulationRate() const
+{
+	return std::pair<double, int>(fixedTimestep > 0.0 ? 1.0 / fixedTimestep : 0.0, maxSubsteps);
+}
+
+void Live2LOVE::setUpdateInterval(int interval)
+{
+	waitSimulation();
+	updateInterval = std::max(interval, 1);
+	autoIntervalScale = 0.0;
+	releaseStepState();
+	restartStepState();
+}
+
+void Live2LOVE::setAutoUpdateInterval(double fullScale, int maxInterval)
+{
+	waitSimulation();
+	autoIntervalScale = std::max(fullScale, 0.0);
+	updateInterval = autoIntervalScale > 0.0 ? std::max(maxInterval, 1) : 1;
+	releaseStepState();
+	restartStepState();
+}
+
+int Live2LOVE::getUpdateInterval() const
+{
+	if (autoIntervalScale > 0.0)
+	{
+		// Smaller on screen, less often simulated
+		double scale = drawScale;
+
+		if (scale >= autoIntervalScale)
+			return 1;
+		else if (scale * updateInterval <= autoIntervalScale)
+			return updateInterval;
+		else
+			return std::min((int) ceil(autoIntervalScale / scale), updateInterval);
+	}
+
+	return updateInterval;
+}
+
+void Live2LOVE::updateParameters(double dt)
+{
+	// Motion update
+	if (motion)
+	{
+		model->LoadParameters();
+		if (motion->IsFinished() && motionLoop.length() > 0)
+			// Revert
+			motion->StartMotion(motionList[motionLoop], false, 1.0f);
+
+		if (!motion->UpdateMotion(model, dt) && movementAnimation)
+		{
+			if (eyeBlink && eyeBlinkMovement)
+				// Update eye blink
+				eyeBlink->UpdateParameters(model, dt);
+		}
+		model->SaveParameters();
+	}
+
+	// Expression update
+	if (expression)
+		expression->UpdateMotion(model, dt);
+
+	// Movement update
+	if (movementAnimation)
+	{
+		// Breath update
+		if (breath)
+			breath->UpdateParameters(model, dt);
+
+		// Physics update
+		if (physics)
+			physics->Evaluate(model, dt);
+	}
+
+	if (pose)
+		pose->UpdateParameters(model, dt);
+
+	// Post-update parameters override whatever motion, physics, and pose set
+	// above. They're not saved, so they only last for this update. Nothing
+	// reads the deformation in between, so applying them before the one and
+	// only model update is equivalent to updating the model twice.
+	if (doubleUpdate.load(std::memory_order_relaxed))
+		csmUpdateModel(model->GetModel());
+
+	for (const Live2LOVEPostParam &param: postParamUpdateList)
+		model->SetParameterValue(param.index, param.value, param.weight);
+
+	// Update model. csmUpdateModel is called directly instead of
+	// CubismModel::Update, as the latter resets the dynamic flags which are
+	// needed below.
+	csmUpdateModel(model->GetModel());
+}
+
+void Live2LOVE::clearPostParams()
+{
+	for (const Live2LOVEPostParam &param: postParamUpdateList)
+		postParamSlot[param.index] = -1;
+
+	postParamUpdateList.clear(); // capacity is kept
+}
+
+void Live2LOVE::updateVertices()
+{
+	// Get dynamic flags
+	const csmFlags *dynamicFlags = csmGetDrawableDynamicFlags(model->GetModel());
+
+	nextStats.uploadedDrawables = 0;
+	bool orderChanged = forceMeshUpdate;
+
+	// Update mesh data
+	for (auto mesh: meshData)
+	{
+		// Check what's changed since last update
+		csmFlags flags = dynamicFlags[mesh->index];
+		orderChanged = orderChanged || (flags & csmRenderOrderDidChange);
+		bool positionChanged = forceMeshUpdate || (flags & csmVertexPositionsDidChange);
+		bool opacityChanged = forceMeshUpdate || (flags & (csmOpacityDidChange | csmVisibilityDidChange));
+		unsigned char alpha = 0;
+
+		if (opacityChanged)
+		{
+			float visibility = (flags & csmIsVisible) ? 1.0f : 0.0f;
+			float opacity = visibility * model->GetDrawableOpacity(mesh->index);
+			alpha = (unsigned char) floor(opacity * 255.0f + 0.5f);
+			setVisible(mesh, alpha > 0);
+		}
+
+		// Invisible drawables are not drawn, but masks are drawn into the
+		// stencil buffer regardless of their visibility.
+		if (!mesh->visible && !mesh->isMask)
+		{
+			// Transform it when it's visible again
+			mesh->positionStale = mesh->positionStale || positionChanged;
+			continue;
+		}
+
+		positionChanged = positionChanged || mesh->positionStale;
+
+		if (!positionChanged && !opacityChanged)
+			continue;
+
+		if (positionChanged)
+		{
+			VertexKernel::transform(
+				mesh->tablePointer,
+				model->GetDrawableVertexPositions(mesh->index),
+				mesh->numPoints,
+				modelPixelUnits, modelOffX, modelOffY,
+				mesh->bounds
+			);
+			mesh->positionStale = false;
+		}
+
+		if (opacityChanged)
+			VertexKernel::fillAlpha(mesh->tablePointer, mesh->numPoints, alpha, mesh->blending == MultiplyBlending);
+
+		nextStats.uploadedDrawables++;
+		mesh->needUpload = true;
+		dirtyStart = std::min(dirtyStart, mesh->vertexOffset);
+		dirtyEnd = std::max(dirtyEnd, mesh->vertexOffset + mesh->numPoints);
+	}
+
+	// Update draw order
+	if (orderChanged)
+		updateDrawOrder();
+
+	updateVisibilityInfo();
+
+	// Dynamic flags are consumed
+	csmResetDrawableDynamicFlags(model->GetModel());
+	forceMeshUpdate = false;
+}
+
+void Live2LOVE::captureState(bool force)
+{
+	const csmFlags *dynamicFlags = csmGetDrawableDynamicFlags(model->GetModel());
+	bool orderChanged = force;
+
+	for (auto mesh: meshData)
+	{
+		csmFlags flags = dynamicFlags[mesh->index];
+		orderChanged = orderChanged || (flags & csmRenderOrderDidChange);
+
+		if (force || (flags & (csmVertexPositionsDidChange | csmOpacityDidChange | csmVisibilityDidChange)))
+		{
+			csmVector2 *prev = &prevVertices[mesh->vertexOffset];
+			csmVector2 *curr = &currVertices[mesh->vertexOffset];
+			const csmVector2 *positions = model->GetDrawableVertexPositions(mesh->index);
+			float visibility = (flags & csmIsVisible) ? 1.0f : 0.0f;
+
+			// Current state becomes previous state. Previous state may be
+			// stale if the drawable didn't change in last step, so it's
+			// always copied here.
+			std::copy(force ? positions : curr, (force ? positions : curr) + mesh->numPoints, prev);
+			std::copy(positions, positions + mesh->numPoints, curr);
+			prevOpacity[mesh->index] = force ? visibility * model->GetDrawableOpacity(mesh->index) : currOpacity[mesh->index];
+			currOpacity[mesh->index] = visibility * model->GetDrawableOpacity(mesh->index);
+
+			mesh->interpolate = !force;
+			mesh->stateChanged = true;
+		}
+		else if (mesh->interpolate)
+		{
+			// Settle at current state
+			mesh->interpolate = false;
+			mesh->stateChanged = true;
+		}
+	}
+
+	if (orderChanged)
+		updateDrawOrder();
+
+	csmResetDrawableDynamicFlags(model->GetModel());
+}
+
+void Live2LOVE::updateInterpolatedVertices(float alpha)
+{
+	nextStats.uploadedDrawables = 0;
+
+	for (auto mesh: meshData)
+	{
+		if (!mesh->interpolate && !mesh->stateChanged)
+			continue;
+
+		const csmVector2 *positions = &currVertices[mesh->vertexOffset];
+		float opacity = currOpacity[mesh->index];
+
+		if (mesh->interpolate)
+		{
+			const csmVector2 *prev = &prevVertices[mesh->vertexOffset];
+
+			if (lerpVertices.size() < (size_t) mesh->numPoints)
+				lerpVertices.resize(mesh->numPoints);
+
+			for (int i = 0; i < mesh->numPoints; i++)
+			{
+				lerpVertices[i].X = prev[i].X + (positions[i].X - prev[i].X) * alpha;
+				lerpVertices[i].Y = prev[i].Y + (positions[i].Y - prev[i].Y) * alpha;
+			}
+
+			positions = lerpVertices.data();
+			opacity = prevOpacity[mesh->index] + (opacity - prevOpacity[mesh->index]) * alpha;
+		}
+
+		unsigned char alpha8 = (unsigned char) floor(opacity * 255.0f + 0.5f);
+		setVisible(mesh, alpha8 > 0);
+		mesh->stateChanged = false;
+
+		if (!mesh->visible && !mesh->isMask)
+			continue;
+
+		VertexKernel::transform(mesh->tablePointer, positions, mesh->numPoints, modelPixelUnits, modelOffX, modelOffY, mesh->bounds);
+		VertexKernel::fillAlpha(mesh->tablePointer, mesh->numPoints, alpha8, mesh->blending == MultiplyBlending);
+
+		nextStats.uploadedDrawables++;
+		mesh->needUpload = true;
+		dirtyStart = std::min(dirtyStart, mesh->vertexOffset);
+		dirtyEnd = std::max(dirtyEnd, mesh->vertexOffset + mesh->numPoints);
+	}
+
+	updateVisibilityInfo();
+}
+
+void Live2LOVE::setVisible(Live2LOVEMesh *mesh, bool visible)
+{
+	if (mesh->visible != visible)
+	{
+		mesh->visible = visible;
+		// Invisible drawables are removed from draw order
+		drawOrderChanged = true;
+	}
+}
+
+void Live2LOVE::updateVisibilityInfo()
+{
+	nextStats.hiddenDrawables = 0;
+	clearBounds(nextBounds);
+
+	for (auto mesh: meshData)
+	{
+		if (mesh->visible)
+		{
+			nextBounds[0] = std::min(nextBounds[0], mesh->bounds[0]);
+			nextBounds[1] = std::min(nextBounds[1], mesh->bounds[1]);
+			nextBounds[2] = std::max(nextBounds[2], mesh->bounds[2]);
+			nextBounds[3] = std::max(nextBounds[3], mesh->bounds[3]);
+		}
+		else
+			nextStats.hiddenDrawables++;
+	}
+}
+
+void Live2LOVE::clearBounds(float *bounds)
+{
+	bounds[0] = bounds[1] = std::numeric_limits<float>::infinity();
+	bounds[2] = bounds[3] = -std::numeric_limits<float>::infinity();
+}
+
+void Live2LOVE::setBatching(bool batch)
+{
+	if (batch && meshMode != MESH_SHARED)
+		throw NamedException("Batching requires shared mesh mode");
+
+	batching = batch;
+	compileDrawCommands();
+}
+
+bool Live2LOVE::isBatching() const
+{
+	return batching;
+}
+
+std::pair<float, float> Live2LOVE::getBoundsMin() const
+{
+	return std::pair<float, float>(bounds[0], bounds[1]);
+}
+
+std::pair<float, float> Live2LOVE::getBoundsMax() const
+{
+	return std::pair<float, float>(bounds[2], bounds[3]);
+}
+
+void Live2LOVE::setCullRect(double x, double y, double w, double h)
+{
+	cullRect[0] = x;
+	cullRect[1] = y;
+	cullRect[2] = x + w;
+	cullRect[3] = y + h;
+	cullEnabled = true;
+}
+
+void Live2LOVE::setCullRect()
+{
+	cullEnabled = false;
+}
+
+bool Live2LOVE::getScreenBounds(const DrawCoordinates &di, const float *bounds, double *screenBounds)
+{
+	screenBounds[0] = screenBounds[1] = HUGE_VAL;
+	screenBounds[2] = screenBounds[3] = -HUGE_VAL;
+
+	// Nothing visible
+	if (bounds[0] > bounds[2] || bounds[1] > bounds[3])
+		return false;
+
+	double m[6];
+	getDrawMatrix(di, m);
+
+	for (int i = 0; i < 4; i++)
+	{
+		double px = bounds[(i & 1) ? 2 : 0];
+		double py = bounds[(i & 2) ? 3 : 1];
+
+		// Apply current love.graphics transformation too
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_TRANSFORMPOINT);
+		lua_pushnumber(L, m[0] * px + m[2] * py + m[4]);
+		lua_pushnumber(L, m[1] * px + m[3] * py + m[5]);
+		lua_call(L, 2, 2);
+		double sx = lua_tonumber(L, -2);
+		double sy = lua_tonumber(L, -1);
+		lua_pop(L, 2);
+
+		screenBounds[0] = std::min(screenBounds[0], sx);
+		screenBounds[1] = std::min(screenBounds[1], sy);
+		screenBounds[2] = std::max(screenBounds[2], sx);
+		screenBounds[3] = std::max(screenBounds[3], sy);
+	}
+
+	return true;
+}
+
+void Live2LOVE::setScissor(int scissorIndex, const double *screenBounds)
+{
+	// Call love.graphics.setScissor with saved scissor
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSCISSOR);
+	if (lua_isnil(L, scissorIndex))
+		lua_call(L, 0, 0);
+	else
+	{
+		for (int i = 0; i < 4; i++)
+			lua_pushvalue(L, scissorIndex + i);
+		lua_call(L, 4, 0);
+	}
+
+	if (screenBounds == nullptr)
+		return;
+
+	// Call love.graphics.intersectScissor. Empty bounds result in empty
+	// scissor.
+	double x = 0.0, y = 0.0, w = 0.0, h = 0.0;
+	if (screenBounds[0] <= screenBounds[2] && screenBounds[1] <= screenBounds[3])
+	{
+		x = floor(screenBounds[0]);
+		y = floor(screenBounds[1]);
+		w = ceil(screenBounds[2]) - x + 1.0;
+		h = ceil(screenBounds[3]) - y + 1.0;
+	}
+
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_INTERSECTSCISSOR);
+	lua_pushnumber(L, x);
+	lua_pushnumber(L, y);
+	lua_pushnumber(L, w);
+	lua_pushnumber(L, h);
+	lua_call(L, 4, 0);
+}
+
+void Live2LOVE::clearStencil(int scissorIndex, const double *screenBounds)
+{
+	// Only clear where the model is
+	setScissor(scissorIndex, screenBounds);
+
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_CLEAR);
+	lua_pushboolean(L, 0);
+	lua_pushinteger(L, 255);
+	lua_call(L, 2, 0);
+
+	setScissor(scissorIndex, nullptr);
+}
+
+void Live2LOVE::publishDrawOrder()
+{
+	drawOrder.clear();
+
+	for (auto mesh: nextDrawOrder)
+	{
+		// Empty draw range is an error in LOVE
+		if (mesh->visible && mesh->indexCount > 0)
+			drawOrder.push_back(mesh);
+	}
+
+	compileDrawCommands();
+	drawOrderChanged = false;
+}
+
+void Live2LOVE::compileDrawCommands()
+{
+	auto blendMode = NormalBlending; // set by draw
+	drawCommands.clear();
+	cacheValid = false;
+	usedMaskSets.clear();
+	hasMaskCommands = hasClipCommands = hasBlendCommands = false;
+	nextStats.drawCalls = 0;
+	std::vector<bool> maskSetUsed(maskSets.size(), false);
+	// Mask set currently in the stencil buffer
+	int stencilMaskSet = -1;
+
+	if (batching)
+	{
+		// Place indices of consecutive drawables next to each other. Hidden
+		// drawables go last, they're still needed for masks.
+		std::vector<Live2LOVEMesh*> order = drawOrder;
+		std::vector<bool> placed(meshData.size(), false);
+		order.reserve(meshData.size());
+
+		for (auto mesh: drawOrder)
+			placed[mesh->index] = true;
+		for (auto mesh: meshData)
+		{
+			if (!placed[mesh->index])
+				order.push_back(mesh);
+		}
+
+		updateVertexMap(order);
+	}
+
+	for (auto mesh: drawOrder)
+	{
+		bool masked = mesh->clipID.size() > 0;
+		bool clipped = masked && clipMode == CLIP_CANVAS && maskSets[mesh->maskSet].channel >= 0;
+
+		if (clipped)
+		{
+			// Shader is going to be set anyway
+			if (!drawCommands.empty() && drawCommands.back().type == DRAW_CLIP_END)
+				drawCommands.pop_back();
+
+			drawCommands.push_back(Live2LOVEDrawCommand {DRAW_CLIP_BEGIN, mesh});
+			hasClipCommands = true;
+
+			if (!maskSetUsed[mesh->maskSet])
+			{
+				maskSetUsed[mesh->maskSet] = true;
+				usedMaskSets.push_back(mesh->maskSet);
+			}
+		}
+		else if (masked)
+		{
+			bool testEnabled = !drawCommands.empty() && drawCommands.back().type == DRAW_MASK_END;
+
+			if (mesh->maskSet == stencilMaskSet)
+			{
+				// Stencil buffer already has the masks
+				if (testEnabled)
+					drawCommands.pop_back();
+				else
+					drawCommands.push_back(Live2LOVEDrawCommand {DRAW_MASK_RESUME, mesh});
+			}
+			else
+			{
+				// Stencil test is going to be set anyway
+				if (testEnabled)
+					drawCommands.pop_back();
+
+				drawCommands.push_back(Live2LOVEDrawCommand {DRAW_MASK_BEGIN, mesh});
+				stencilMaskSet = mesh->maskSet;
+			}
+
+			hasMaskCommands = true;
+		}
+
+		if (mesh->blending != blendMode)
+		{
+			drawCommands.push_back(Live2LOVEDrawCommand {DRAW_BLEND, mesh});
+			blendMode = mesh->blending;
+			hasBlendCommands = true;
+		}
+
+		Live2LOVEDrawCommand *prev = drawCommands.empty() ? nullptr : &drawCommands.back();
+
+		// Previous DRAW_MESH is never masked, as DRAW_MASK_END follows
+		// masked drawables.
+		if (
+			batching && !masked && prev && prev->type == DRAW_MESH &&
+			prev->mesh->textureIndex == mesh->textureIndex &&
+			prev->mesh->blending == mesh->blending &&
+			prev->indexStart + prev->indexCount == mesh->indexOffset
+		)
+			// Merge with previous draw
+			prev->indexCount += mesh->indexCount;
+		else
+		{
+			drawCommands.push_back(Live2LOVEDrawCommand {DRAW_MESH, mesh, mesh->indexOffset, mesh->indexCount});
+			nextStats.drawCalls++;
+		}
+
+		if (clipped)
+			drawCommands.push_back(Live2LOVEDrawCommand {DRAW_CLIP_END, mesh});
+		else if (masked)
+			drawCommands.push_back(Live2LOVEDrawCommand {DRAW_MASK_END, mesh});
+	}
+}
+
+void Live2LOVE::upload()
+{
+	// Publish draw order and statistics
+	if (drawOrderChanged)
+		publishDrawOrder();
+	stats = nextStats;
+	std::copy(nextBounds, nextBounds + 4, bounds);
+
+	// Mask bounds are needed by draw
+	updateMaskSets();
+
+	if (dirtyStart >= dirtyEnd)
+		return;
+
+	cacheValid = false;
+
+	if (meshMode == MESH_SHARED)
+	{
+		// Upload changed vertices at once
+		RefData::getRef(L, sharedMeshRefID);
+		lua_getfield(L, -1, "setVertices");
+		lua_pushvalue(L, -2);
+
+		// Only upload the changed range. The same drawables usually change
+		// every frame, so the view is reused instead of making garbage.
+		if (uploadViewRefID == LUA_NOREF || dirtyStart != uploadViewStart || dirtyEnd != uploadViewEnd)
+		{
+			RefData::delRef(L, uploadViewRefID);
+			RefData::getRef(L, RefData::LOVE_DATA_NEWDATAVIEW);
+			RefData::getRef(L, sharedTableRefID);
+			lua_pushinteger(L, dirtyStart * sizeof(Live2LOVEMeshFormat));
+			lua_pushinteger(L, (dirtyEnd - dirtyStart) * sizeof(Live2LOVEMeshFormat));
+			lua_call(L, 3, 1);
+			uploadViewRefID = RefData::setRef(L, -1);
+			uploadViewStart = dirtyStart;
+			uploadViewEnd = dirtyEnd;
+		}
+		else
+			RefData::getRef(L, uploadViewRefID);
+
+		lua_pushinteger(L, dirtyStart + 1);
+		lua_call(L, 3, 0);
+		lua_pop(L, 1);
+
+		for (auto mesh: meshData)
+			mesh->needUpload = false;
+	}
+	else
+	{
+		for (auto mesh: meshData)
+		{
+			if (!mesh->needUpload)
+				continue;
+
+			// Call setVertices
+			RefData::getRef(L, mesh->meshRefID);
+			lua_getfield(L, -1, "setVertices");
+			lua_pushvalue(L, -2);
+			RefData::getRef(L, mesh->tableRefID);
+			lua_call(L, 2, 0);
+
+			// Pop Mesh object
+			lua_pop(L, 1);
+			mesh->needUpload = false;
+		}
+	}
+
+	dirtyStart = INT_MAX;
+	dirtyEnd = 0;
+}
+
+void Live2LOVE::updateDrawOrder()
+{
+	const csmInt32 *renderOrders = model->GetDrawableRenderOrders();
+	int drawableCount = (int) meshData.size();
+	bool isPermutation = true;
+
+	// Render orders are permutation of drawable indices, so inverse them.
+	for (auto mesh: meshData)
+	{
+		int renderOrder = mesh->renderOrder = renderOrders[mesh->index];
+
+		if (renderOrder >= 0 && renderOrder < drawableCount)
+			nextDrawOrder[renderOrder] = mesh;
+		else
+			isPermutation = false;
+	}
+
+	// Shouldn't happen, but don't leave stale pointers.
+	if (!isPermutation)
+	{
+		nextDrawOrder = meshData;
+		std::stable_sort(nextDrawOrder.begin(), nextDrawOrder.end(), compareDrawOrder);
+	}
+
+	drawOrderChanged = true;
+}
+
+void Live2LOVE::draw(double x, double y, double r, double sx, double sy, double ox, double oy, double kx, double ky)
+{
+	// Used for automatic update interval
+	drawScale = (float) std::max(fabs(sx), fabs(sy));
+
+	if (!lua_checkstack(L, lua_gettop(L) + 24))
+		throw NamedException("Internal error: cannot grow Lua stack size");
+
+	// Setup DrawCoordinates
+	DrawCoordinates drawInfo {x, y, r, sx, sy, ox, oy, kx, ky};
+	// Screen bounds, only computed when needed
+	double screenBoundsData[4];
+	const double *screenBounds = nullptr;
+
+	// Cache can't blend multiply and additive drawables with the background
+	bool useCache = renderCache && !hasBlendCommands;
+
+	// Without bounds, draw without scissor, culling, and render cache
+	if ((cullEnabled || hasMaskCommands || useCache) && getScreenBounds(drawInfo, bounds, screenBoundsData))
+	{
+		if (cullEnabled && (
+			screenBoundsData[2] < cullRect[0] || screenBoundsData[0] > cullRect[2] ||
+			screenBoundsData[3] < cullRect[1] || screenBoundsData[1] > cullRect[3]
+		))
+			return;
+
+		screenBounds = screenBoundsData;
+	}
+
+	if (useCache && screenBounds && drawCache(drawInfo))
+		return;
+
+	drawModel(drawInfo, screenBounds);
+}
+
+void Live2LOVE::drawModel(const DrawCoordinates &drawInfo, const double *screenBounds, int instances, int instanceGroups)
+{
+	DrawState state;
+	state.drawInfo = drawInfo;
+	state.instances = instances;
+	state.instanceGroups = instanceGroups;
+	state.screenBounds = screenBounds;
+	state.scissorMasks = screenBounds != nullptr;
+	state.redrawMasks = false;
+	state.shaderIndex = state.drawShaderIndex = 0;
+	state.scissorIndex = state.drawInstancedIndex = 0;
+	state.stencilValue = 1;
+	state.maskValue = 0;
+	state.clipSet = nullptr;
+	state.clipPremultiplied = false;
+	state.blending = NormalBlending;
+
+	// Save blending
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_SETBLENDMODE);
+	state.setBlendModeIndex = lua_gettop(L);
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_GETBLENDMODE);
+	lua_call(L, 0, 2);
+
+	// Set blending mode to alpha,alphamultiply
+	setBlending(state.setBlendModeIndex, NormalBlending);
+
+	// Backup shader
+	if (hasMaskCommands || hasClipCommands || state.instances > 0)
+	{
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_GETSHADER);
+		lua_call(L, 0, 1);
+		state.shaderIndex = state.drawShaderIndex = lua_gettop(L);
+	}
+
+	if (state.instances > 0)
+	{
+		RefData::getRef(L, instanceShaderRef);
+		state.drawShaderIndex = lua_gettop(L);
+
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSHADER);
+		lua_pushvalue(L, state.drawShaderIndex);
+		lua_call(L, 1, 0);
+
+		setInstanceGroup(-1);
+	}
+
+	if (hasClipCommands)
+		drawMaskCanvas();
+
+	if (hasMaskCommands)
+	{
+		// Backup scissor
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_GETSCISSOR);
+		lua_call(L, 0, 4);
+		state.scissorIndex = lua_gettop(L) - 3;
+
+		clearStencil(state.scissorIndex, screenBounds);
+	}
+
+	// Get love.graphics.draw and love.graphics.drawInstanced
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_DRAW);
+	state.drawIndex = lua_gettop(L);
+
+	if (state.instances > 0)
+	{
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_DRAWINSTANCED);
+		state.drawInstancedIndex = lua_gettop(L);
+	}
+
+	replayCommands(state, 0, drawCommands.size());
+
+	if (state.instances > 0)
+	{
+		// Restore shader
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSHADER);
+		lua_pushvalue(L, state.shaderIndex);
+		lua_call(L, 1, 0);
+	}
+
+	// Remove love.graphics.draw and shader
+	lua_settop(L, state.setBlendModeIndex + 2);
+	// Reset blend mode
+	lua_call(L, 2, 0);
+}
+
+void Live2LOVE::setBlending(int setBlendModeIndex, Rendering::CubismRenderer::CubismBlendMode blending)
+{
+	constexpr unsigned int ZERO = 0;
+	constexpr unsigned int ONE = 1;
+	constexpr unsigned int DST_COLOR = 0x0306;
+	constexpr unsigned int ONE_MINUS_SRC_ALPHA = 0x0303;
+
+	lua_pushvalue(L, setBlendModeIndex);
+
+	switch (blending)
+	{
+		default:
+		case NormalBlending:
+		{
+			// Normal blending (alpha, alphamultiply)
+			lua_pushstring(L, "alpha");
+			lua_pushstring(L, "alphamultiply");
+			break;
+		}
+		case AddBlending:
+		{
+			// Add blending (add, alphamultiply)
+			lua_pushstring(L, "add");
+			lua_pushstring(L, "alphamultiply");
+			break;
+		}
+		case MultiplyBlending:
+		{
+			// Multiply blending (multiply, premultiplied)
+			// Needs some specialization, see below
+			lua_pushstring(L, "multiply");
+			lua_pushstring(L, "premultiplied");
+			break;
+		}
+	}
+
+	// Set blend mode
+	lua_call(L, 2, 0);
+
+	// Override multiply blend mode
+	if (blending == MultiplyBlending && glBlendFuncSeparate)
+		// FIXME: LOVE 12.0 have low-level blending mode and non-GL renderer.
+		// Rectify this and use low-level blending mode in the future.
+		glBlendFuncSeparate(DST_COLOR, ONE_MINUS_SRC_ALPHA, ZERO, ONE);
+}
+
+void Live2LOVE::replayCommands(DrawState &state, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++)
+	{
+		const Live2LOVEDrawCommand &cmd = drawCommands[i];
+
+		if (state.instanceGroups > 1 && (cmd.type == DRAW_MASK_BEGIN || cmd.type == DRAW_MASK_RESUME))
+		{
+			// Masked drawables up to DRAW_MASK_END are drawn per group
+			size_t spanEnd = i + 1;
+			while (spanEnd < end && drawCommands[spanEnd].type != DRAW_MASK_END)
+				spanEnd++;
+
+			drawMaskedInstances(state, i, spanEnd);
+			i = spanEnd - 1;
+			continue;
+		}
+
+		switch (cmd.type)
+		{
+			case DRAW_MESH:
+			{
+				if (state.instances > 0)
+				{
+					// Instances have their own transformation
+					lua_pushvalue(L, state.drawInstancedIndex);
+					pushMesh(cmd.mesh, cmd.indexStart, cmd.indexCount);
+					lua_pushinteger(L, state.instances);
+					lua_call(L, 2, 0);
+				}
+				else
+				{
+					lua_pushvalue(L, state.drawIndex);
+					pushMesh(cmd.mesh, cmd.indexStart, cmd.indexCount);
+					pushDrawCoordinates(L, state.drawInfo);
+					lua_call(L, 10, 0);
+				}
+				break;
+			}
+			case DRAW_BLEND:
+			{
+				setBlending(state.setBlendModeIndex, cmd.mesh->blending);
+				state.blending = cmd.mesh->blending;
+				break;
+			}
+			case DRAW_MASK_RESUME:
+			{
+				if (!state.redrawMasks)
+				{
+					if (state.scissorMasks)
+						setScissor(state.scissorIndex, state.maskBounds);
+
+					// Call love.graphics.setStencilTest("equal", maskValue);
+					RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSTENCILTEST);
+					lua_pushlstring(L, "equal", 5);
+					lua_pushinteger(L, state.maskValue);
+					lua_call(L, 2, 0);
+					break;
+				}
+
+				// Stencil buffer has masks of another instance group, draw the
+				// masks again
+			}
+			case DRAW_MASK_BEGIN:
+			{
+				const Live2LOVEMaskSet &maskSet = maskSets[cmd.mesh->maskSet];
+				int depth = maskSet.depth;
+
+				// 255 is the cleared value
+				if (state.stencilValue + depth > 255)
+				{
+					clearStencil(state.scissorIndex, state.screenBounds);
+					state.stencilValue = 1;
+				}
+
+				if (state.scissorMasks)
+				{
+					// Empty bounds if the masks have nothing to draw
+					getScreenBounds(state.drawInfo, maskSet.bounds, state.maskBounds);
+					setScissor(state.scissorIndex, state.maskBounds);
+				}
+
+				RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSHADER);
+				RefData::getRef(L, state.instances > 0 ? instanceStencilShaderRef : stencilFragRef);
+				lua_call(L, 1, 0);
+
+				// Draw stencil main loop
+				state.maskValue = state.stencilValue;
+				drawStencil(cmd.mesh, state.drawInfo, state.maskValue, 1, state.instances);
+				state.stencilValue += depth;
+
+				// Call love.graphics.setStencilTest("equal", maskValue);
+				RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSTENCILTEST);
+				lua_pushlstring(L, "equal", 5);
+				lua_pushinteger(L, state.maskValue);
+				lua_call(L, 2, 0);
+
+				// Restore shader
+				RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSHADER);
+				lua_pushvalue(L, state.drawShaderIndex);
+				lua_call(L, 1, 0);
+				break;
+			}
+			case DRAW_CLIP_BEGIN:
+			{
+				const Live2LOVEMaskSet *maskSet = &maskSets[cmd.mesh->maskSet];
+				bool premultiplied = cmd.mesh->blending == MultiplyBlending;
+
+				if (state.clipSet == nullptr)
+				{
+					RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSHADER);
+					RefData::getRef(L, clipShaderRef);
+					lua_call(L, 1, 0);
+				}
+
+				// Only send what's changed
+				if (maskSet != state.clipSet)
+				{
+					const float *t = maskSet->transform;
+					const float *r = maskSet->region;
+					float size = (float) maskCanvasSize;
+					float clipMatrix[4] = {t[0] / size, t[1] / size, t[2] / size, t[3] / size};
+					float clipRect[4] = {r[0], r[1], r[0] + r[2], r[1] + r[3]};
+					float clipChannel[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+					clipChannel[maskSet->channel] = 1.0f;
+
+					// Nothing passes empty mask
+					if (maskSet->empty)
+						clipRect[0] = clipRect[1] = 2.0f;
+
+					sendClipVector("clipMatrix", clipMatrix);
+					sendClipVector("clipRect", clipRect);
+					sendClipVector("clipChannel", clipChannel);
+				}
+
+				if (state.clipSet == nullptr || premultiplied != state.clipPremultiplied)
+				{
+					RefData::getRef(L, clipShaderRef);
+					lua_getfield(L, -1, "send");
+					lua_insert(L, -2);
+					lua_pushstring(L, "clipPremultiplied");
+					lua_pushnumber(L, premultiplied ? 1.0 : 0.0);
+					lua_call(L, 3, 0);
+				}
+
+				state.clipSet = maskSet;
+				state.clipPremultiplied = premultiplied;
+				break;
+			}
+			case DRAW_CLIP_END:
+			{
+				// Restore shader
+				RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSHADER);
+				lua_pushvalue(L, state.shaderIndex);
+				lua_call(L, 1, 0);
+				state.clipSet = nullptr;
+				break;
+			}
+			case DRAW_MASK_END:
+			{
+				// Disable stencil test. Stencil buffer is kept, in case the
+				// same masks are used again.
+				RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSTENCILTEST);
+				lua_call(L, 0, 0);
+				setScissor(state.scissorIndex, nullptr);
+				break;
+			}
+		}
+	}
+}
+
+void Live2LOVE::drawMaskedInstances(DrawState &state, size_t begin, size_t end)
+{
+	// Instances of the same group don't overlap, so their masks can share
+	// stencil values. Every group draws its masks and masked drawables
+	// instanced, and the other instances are discarded by the shader.
+	DrawState groupState = state;
+	groupState.instanceGroups = 1;
+	groupState.redrawMasks = true;
+
+	for (int i = 0; i < state.instanceGroups; i++)
+	{
+		setInstanceGroup(i);
+
+		// Every group starts with blending of the span
+		if (i > 0 && groupState.blending != state.blending)
+			setBlending(state.setBlendModeIndex, state.blending);
+
+		groupState.blending = state.blending;
+		replayCommands(groupState, begin, end);
+	}
+
+	setInstanceGroup(-1);
+
+	state.stencilValue = groupState.stencilValue;
+	state.maskValue = groupState.maskValue;
+	state.blending = groupState.blending;
+}
+
+void Live2LOVE::setInstanceGroup(int group)
+{
+	int shaders[2] = {instanceShaderRef, instanceStencilShaderRef};
+
+	for (int ref: shaders)
+	{
+		RefData::getRef(L, ref);
+		lua_getfield(L, -1, "send");
+		lua_insert(L, -2);
+		lua_pushstring(L, "instanceGroup");
+		lua_pushnumber(L, group);
+		lua_call(L, 3, 0);
+	}
+}
+
+void Live2LOVE::drawInstanced(const std::vector<DrawInstance> &instanceList)
+{
+	if (instanceList.empty())
+		return;
+
+	// Clip shader doesn't know about instances
+	if (hasClipCommands)
+		throw NamedException("Instanced drawing requires stencil clipping mode");
+
+	if (!lua_checkstack(L, lua_gettop(L) + 32))
+		throw NamedException("Internal error: cannot grow Lua stack size");
+
+	int count = (int) instanceList.size();
+	setupInstancing(count);
+
+	// Masks of an instance must not cover drawables of other instances in
+	// its group, so group by the bounds of the drawables and the masks
+	float drawBounds[4];
+	std::copy(bounds, bounds + 4, drawBounds);
+	if (hasMaskCommands)
+	{
+		for (const Live2LOVEMaskSet &maskSet: maskSets)
+		{
+			drawBounds[0] = std::min(drawBounds[0], maskSet.bounds[0]);
+			drawBounds[1] = std::min(drawBounds[1], maskSet.bounds[1]);
+			drawBounds[2] = std::max(drawBounds[2], maskSet.bounds[2]);
+			drawBounds[3] = std::max(drawBounds[3], maskSet.bounds[3]);
+		}
+	}
+
+	// Screen bounds of the instances in every group
+	std::vector<std::vector<std::array<double, 4>>> groups(1);
+	float scale = 0.0f;
+
+	for (int i = 0; i < count; i++)
+	{
+		const DrawInstance &instance = instanceList[i];
+		Live2LOVEInstanceFormat &dest = instanceTablePointer[i];
+		double m[6];
+		getDrawMatrix(instance.coords, m);
+
+		// Put the instance to the first group it doesn't overlap
+		size_t group = 0;
+		std::array<double, 4> instanceBounds;
+		if (hasMaskCommands && getScreenBounds(instance.coords, drawBounds, instanceBounds.data()))
+		{
+			for (; group < groups.size(); group++)
+			{
+				bool overlap = false;
+				for (const std::array<double, 4> &b: groups[group])
+				{
+					if (instanceBounds[0] < b[2] && instanceBounds[2] > b[0] &&
+						instanceBounds[1] < b[3] && instanceBounds[3] > b[1])
+					{
+						overlap = true;
+						break;
+					}
+				}
+
+				if (!overlap)
+					break;
+			}
+
+			if (group == groups.size())
+				groups.emplace_back();
+
+			groups[group].push_back(instanceBounds);
+		}
+
+		dest.group = (float) group;
+
+		dest.x[0] = (float) m[0];
+		dest.x[1] = (float) m[2];
+		dest.x[2] = (float) m[4];
+		dest.y[0] = (float) m[1];
+		dest.y[1] = (float) m[3];
+		dest.y[2] = (float) m[5];
+
+		unsigned char *color = &dest.r;
+		for (int j = 0; j < 4; j++)
+			color[j] = (unsigned char) floor(std::min(std::max(instance.color[j], 0.0f), 1.0f) * 255.0f + 0.5f);
+
+		scale = std::max(scale, (float) std::max(fabs(instance.coords.sx), fabs(instance.coords.sy)));
+	}
+
+	// Used for automatic update interval
+	drawScale = scale;
+
+	// Upload used instances
+	RefData::getRef(L, instanceMeshRefID);
+	lua_getfield(L, -1, "setVertices");
+	lua_pushvalue(L, -2);
+	RefData::getRef(L, RefData::LOVE_DATA_NEWDATAVIEW);
+	RefData::getRef(L, instanceTableRefID);
+	lua_pushinteger(L, 0);
+	lua_pushinteger(L, count * sizeof(Live2LOVEInstanceFormat));
+	lua_call(L, 3, 1);
+	lua_call(L, 2, 0);
+	lua_pop(L, 1);
 
-			// Restore shader
-			RefData::getRef(L, "love.graphics.setShader");
-			lua_pushvalue(L, -2);
-			lua_call(L, 1, 0);
+	// Instances are placed by the shader
+	DrawCoordinates identity {0, 0, 0, 1, 1, 0, 0, 0, 0};
+	drawModel(identity, nullptr, count, (int) groups.size());
+}
 
-			// Remove shader
+void Live2LOVE::setupInstancing(int count)
+{
+	// Instancing shader is shared by all models
+	if (instanceShaderRef == LUA_REFNIL)
+	{
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWSHADER);
+		lua_pushstring(L, instanceVertex);
+		if (lua_pcall(L, 1, 1, 0) != 0)
+		{
+			NamedException temp(lua_tostring(L, -1));
 			lua_pop(L, 1);
+			throw temp;
 		}
 
-		auto meshBlendMode = mesh->blending;
+		instanceShaderRef = RefData::setRef(L, -1);
+		lua_pop(L, 1);
 
-		if (meshBlendMode != blendMode)
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWSHADER);
+		lua_pushstring(L, stencilFragment);
+		lua_pushstring(L, instanceVertex);
+		if (lua_pcall(L, 2, 1, 0) != 0)
 		{
-			constexpr unsigned int ZERO = 0;
-			constexpr unsigned int ONE = 1;
-			constexpr unsigned int DST_COLOR = 0x0306;
-			constexpr unsigned int ONE_MINUS_SRC_ALPHA = 0x0303;
+			NamedException temp(lua_tostring(L, -1));
+			lua_pop(L, 1);
+			throw temp;
+		}
 
-			// Push love.graphics.setBlendMode
-			lua_pushvalue(L, -4);
+		instanceStencilShaderRef = RefData::setRef(L, -1);
+		lua_pop(L, 1);
+	}
 
-			switch (blendMode = meshBlendMode)
-			{
-				default:
-				case NormalBlending:
-				{
-					// Normal blending (alpha, alphamultiply)
-					lua_pushstring(L, "alpha");
-					lua_pushstring(L, "alphamultiply");
-					break;
-				}
-				case AddBlending:
-				{
-					// Add blending (add, alphamultiply)
-					lua_pushstring(L, "add");
-					lua_pushstring(L, "alphamultiply");
-					break;
-				}
-				case MultiplyBlending:
-				{
-					// Multiply blending (multiply, premultiplied)
-					// Needs some specialization, see below
-					lua_pushstring(L, "multiply");
-					lua_pushstring(L, "premultiplied");
-					break;
-				}
-			}
+	if (count <= instanceCapacity)
+		return;
+
+	int capacity = std::max(count, instanceCapacity * 2);
+	static const char *attributeNames[4] = {"InstanceX", "InstanceY", "InstanceGroup", "InstanceColor"};
+	static const char *attributeTypes[4] = {"float", "float", "float", "byte"};
+	static const int attributeSizes[4] = {3, 3, 1, 4};
+
+	// Call love.graphics.newMesh(format, capacity, "points", "stream")
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWMESH);
+	pushMeshFormat(L, attributeNames, attributeTypes, attributeSizes, 4);
+	lua_pushinteger(L, capacity);
+	lua_pushstring(L, "points");
+	lua_pushstring(L, "stream");
+	lua_call(L, 4, 1);
+
+	RefData::delRef(L, instanceMeshRefID);
+	instanceMeshRefID = RefData::setRef(L, -1);
+	int instanceMeshIndex = lua_gettop(L);
+
+	// Attach per-instance attributes to the drawable Mesh objects
+	std::vector<int> meshRefs;
+	if (meshMode == MESH_SHARED)
+		meshRefs.push_back(sharedMeshRefID);
+	else
+	{
+		for (Live2LOVEMesh *mesh: meshData)
+			meshRefs.push_back(mesh->meshRefID);
+	}
 
-			// Set blend mode
-			lua_call(L, 2, 0);
+	for (int ref: meshRefs)
+	{
+		RefData::getRef(L, ref);
 
-			// Override multiply blend mode
-			if (meshBlendMode == MultiplyBlending && glBlendFuncSeparate)
-				// FIXME: LOVE 12.0 have low-level blending mode and non-GL renderer.
-				// Rectify this and use low-level blending mode in the future.
-				glBlendFuncSeparate(DST_COLOR, ONE_MINUS_SRC_ALPHA, ZERO, ONE);
-		}
-		lua_pushvalue(L, -1);
-		RefData::getRef(L, mesh->meshRefID);
-		lua_pushnumber(L, x);
-		lua_pushnumber(L, y);
-		lua_pushnumber(L, r);
-		lua_pushnumber(L, sx);
-		lua_pushnumber(L, sy);
-		lua_pushnumber(L, ox);
-		lua_pushnumber(L, oy);
-		lua_pushnumber(L, kx);
-		lua_pushnumber(L, ky);
-		// Draw
-		lua_call(L, 10, 0);
-
-		// If there's stencil, disable it.
-		if (stencilSet)
+		for (int i = 0; i < 4; i++)
 		{
-			// Disable stencil test
-			RefData::getRef(L, "love.graphics.setStencilTest");
-			lua_call(L, 0, 0);
-
-			// Clear stencil buffer
-			RefData::getRef(L, "love.graphics.clear");
-			lua_pushboolean(L, 0);
-			lua_pushinteger(L, 255);
-			lua_call(L, 2, 0);
+			lua_getfield(L, -1, "attachAttribute");
+			lua_pushvalue(L, -2);
+			lua_pushstring(L, attributeNames[i]);
+			lua_pushvalue(L, instanceMeshIndex);
+			lua_pushstring(L, "perinstance");
+			lua_call(L, 4, 0);
 		}
+
+		lua_pop(L, 1);
 	}
 
-	// Remove love.graphics.draw
+	// Pop the instance Mesh
 	lua_pop(L, 1);
-	// Reset blend mode
-	lua_call(L, 2, 0);
+
+	instanceTablePointer = createData<Live2LOVEInstanceFormat>(L, capacity);
+	RefData::delRef(L, instanceTableRefID);
+	instanceTableRefID = RefData::setRef(L, -1);
+	lua_pop(L, 1); // pop the ByteData reference
+	instanceCapacity = capacity;
 }
 
 void Live2LOVE::setTexture(int live2dtexno, int loveimageidx)
 {
 	live2dtexno--;
+	cacheValid = false;
 
 	// Bounds checking
 	if (live2dtexno < 0 || live2dtexno >= needPMATexture.size())
@@ -699,31 +2497,44 @@ void Live2LOVE::setTexture(int live2dtexno, int loveimageidx)
 	if (needPMATexture[live2dtexno] && width != 0 && height != 0)
 		index = setupPMATexture(width, height, loveimageidx);
 
-	// List mesh
-	for (Live2LOVEMesh *mesh: meshData)
+	if (meshMode == MESH_SHARED)
+	{
+		// Textures are bound to the shared mesh when drawing
+		RefData::delRef(L, textureRefID[live2dtexno]);
+		RefData::delRef(L, pmaTextureRefID[live2dtexno]);
+		textureRefID[live2dtexno] = lua_isnil(L, loveimageidx) ? LUA_REFNIL : RefData::setRef(L, loveimageidx);
+		pmaTextureRefID[live2dtexno] = index != -1 ? RefData::setRef(L, index) : LUA_REFNIL;
+		// Reference IDs can be reused, so force texture rebind
+		sharedTextureRefID = LUA_NOREF;
+	}
+	else
 	{
-		if (mesh->textureIndex == live2dtexno)
+		// List mesh
+		for (Live2LOVEMesh *mesh: meshData)
 		{
-			// Get mesh ref
-			RefData::getRef(L, mesh->meshRefID);
-			lua_getfield(L, -1, "setTexture");
-			lua_pushvalue(L, -2);
-
-			if (mesh->blending == MultiplyBlending)
+			if (mesh->textureIndex == live2dtexno)
 			{
-				if (index != -1)
-					lua_pushvalue(L, index);
+				// Get mesh ref
+				RefData::getRef(L, mesh->meshRefID);
+				lua_getfield(L, -1, "setTexture");
+				lua_pushvalue(L, -2);
+
+				if (mesh->blending == MultiplyBlending)
+				{
+					if (index != -1)
+						lua_pushvalue(L, index);
+					else
+						lua_pushnil(L);
+				}
 				else
-					lua_pushnil(L);
-			}
-			else
-				lua_pushvalue(L, loveimageidx);
+					lua_pushvalue(L, loveimageidx);
 
-			// Call it
-			lua_call(L, 2, 0);
+				// Call it
+				lua_call(L, 2, 0);
 
-			// Remove mesh
-			lua_pop(L, 1);
+				// Remove mesh
+				lua_pop(L, 1);
+			}
 		}
 	}
 
@@ -734,11 +2545,13 @@ void Live2LOVE::setTexture(int live2dtexno, int loveimageidx)
 
 void Live2LOVE::setAnimationMovement(bool a)
 {
+	waitSimulation();
 	movementAnimation = a;
 }
 
 void Live2LOVE::setEyeBlinkMovement(bool a)
 {
+	waitSimulation();
 	eyeBlinkMovement = a;
 }
 
@@ -754,33 +2567,134 @@ bool Live2LOVE::isEyeBlinkEnabled() const
 
 void Live2LOVE::setParamValue(const std::string& name, double value, double weight)
 {
-	const CubismId *paramName = CubismFramework::GetIdManager()->GetId(name.c_str());
+	waitSimulation();
+	const CubismId *paramName = toCsmString(name);
 	model->SetParameterValue(model->GetParameterIndex(paramName), value, weight);
 }
 
 void Live2LOVE::setParamValuePost(const std::string& name, double value, double weight)
 {
-	postParamUpdateList[name] = new std::pair<double, double>(value, weight);
+	waitSimulation();
+	const CubismId *paramName = toCsmString(name);
+	queuePostParam(model->GetParameterIndex(paramName), (float) value, (float) weight);
+}
+
+void Live2LOVE::queuePostParam(int index, float value, float weight)
+{
+	// Parameters which don't exist in the model have no effect on it
+	if (index < 0 || index >= (int) postParamSlot.size())
+		return;
+
+	// Setting same parameter twice overwrites the previous value
+	int &slot = postParamSlot[index];
+	if (slot == -1)
+	{
+		slot = (int) postParamUpdateList.size();
+		postParamUpdateList.push_back({index, value, weight});
+	}
+	else
+		postParamUpdateList[slot] = {index, value, weight};
 }
 
 void Live2LOVE::addParamValue(const std::string& name, double value, double weight)
 {
-	const CubismId *paramName = CubismFramework::GetIdManager()->GetId(name.c_str());
+	waitSimulation();
+	const CubismId *paramName = toCsmString(name);
 	model->AddParameterValue(paramName, (float) value, (float) weight);
 }
 
 void Live2LOVE::mulParamValue(const std::string& name, double value, double weight)
 {
-	const CubismId *paramName = CubismFramework::GetIdManager()->GetId(name.c_str());
+	waitSimulation();
+	const CubismId *paramName = toCsmString(name);
 	model->MultiplyParameterValue(paramName, value, weight);
 }
 
 double Live2LOVE::getParamValue(const std::string& name) const
 {
-	const CubismId *paramName = CubismFramework::GetIdManager()->GetId(name.c_str());
+	waitSimulation();
+	const CubismId *paramName = toCsmString(name);
 	return model->GetParameterValue(paramName);
 }
 
+int Live2LOVE::getParamIndex(const std::string& name) const
+{
+	return getParamIndex(name.c_str());
+}
+
+int Live2LOVE::getParamIndex(const char *name) const
+{
+	// Unlike CubismModel::GetParameterIndex, this doesn't register
+	// parameters which doesn't exist in the model.
+	csmModel *mdl = model->GetModel();
+	int paramCount = csmGetParameterCount(mdl);
+	const char **paramIDs = csmGetParameterIds(mdl);
+
+	for (int i = 0; i < paramCount; i++)
+	{
+		if (strcmp(name, paramIDs[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+void Live2LOVE::setParamValue(int index, double value, double weight)
+{
+	waitSimulation();
+	model->SetParameterValue(index, (float) value, (float) weight);
+}
+
+void Live2LOVE::setParamValuePost(int index, double value, double weight)
+{
+	waitSimulation();
+	queuePostParam(index, (float) value, (float) weight);
+}
+
+void Live2LOVE::addParamValue(int index, double value, double weight)
+{
+	waitSimulation();
+	model->AddParameterValue(index, (float) value, (float) weight);
+}
+
+void Live2LOVE::mulParamValue(int index, double value, double weight)
+{
+	waitSimulation();
+	model->MultiplyParameterValue(index, (float) value, (float) weight);
+}
+
+double Live2LOVE::getParamValue(int index) const
+{
+	waitSimulation();
+	return model->GetParameterValue(index);
+}
+
+void Live2LOVE::applyParams(ParamOpID op, const std::vector<Live2LOVEPostParam> &params)
+{
+	waitSimulation();
+
+	for (const Live2LOVEPostParam &param: params)
+	{
+		switch (op)
+		{
+			case PARAM_SET:
+				model->SetParameterValue(param.index, param.value, param.weight);
+				break;
+			case PARAM_SET_POST:
+				queuePostParam(param.index, param.value, param.weight);
+				break;
+			case PARAM_ADD:
+				model->AddParameterValue(param.index, param.value, param.weight);
+				break;
+			case PARAM_MUL:
+				model->MultiplyParameterValue(param.index, param.value, param.weight);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
 std::vector<Live2LOVEParamDef> Live2LOVE::getParamInfoList()
 {
 	csmModel *mdl = model->GetModel();
@@ -804,7 +2718,7 @@ std::vector<const std::string*> Live2LOVE::getExpressionList() const
 {
 	std::vector<const std::string*> value = {};
 
-	for (auto& x: expressionList)
+	for (auto& x: definition->expressions)
 		value.push_back(&x.first);
 
 	return value;
@@ -814,7 +2728,7 @@ std::vector<const std::string*> Live2LOVE::getMotionList() const
 {
 	std::vector<const std::string*> value = {};
 
-	for (auto& x: motionList)
+	for (auto& x: definition->motions)
 		value.push_back(&x.first);
 
 	return value;
@@ -827,13 +2741,15 @@ std::pair<float, float> Live2LOVE::getDimensions() const
 
 void Live2LOVE::setMotion(const std::string& name, MotionModeID mode)
 {
+	waitSimulation();
 	// No motion? well load one first before using this.
 	if (!motion)
 		throw NamedException("No motion loaded!");
-	else if (motionList.find(name) == motionList.end())
+
+	CubismMotion *targetMotion = getMotion(name);
+	if (targetMotion == nullptr)
 		throw NamedException("Motion not found");
 
-	CubismMotion *targetMotion = motionList[name];
 	motion->StartMotion(targetMotion, false, targetMotion->GetFadeInTime());
 
 	// Check motion mode
@@ -843,6 +2759,7 @@ void Live2LOVE::setMotion(const std::string& name, MotionModeID mode)
 
 void Live2LOVE::setMotion()
 {
+	waitSimulation();
 	// clear motion
 	if (!motion)
 		throw NamedException("No motion loaded!");
@@ -853,18 +2770,23 @@ void Live2LOVE::setMotion()
 
 void Live2LOVE::setExpression(const std::string& name)
 {
+	waitSimulation();
 	// No expression? Load one first!
 	if (!expression)
 		throw NamedException("No expression loaded!");
-	else if (expressionList.find(name) == expressionList.end())
+
+	CubismExpressionMotion *expr = getExpression(name);
+	if (expr == nullptr)
 		throw NamedException("Expression not found");
 
-	CubismExpressionMotion *expr = expressionList[name];
-	expression->StartMotion(expressionList[name], false, expr->GetFadeInTime());
+	expression->StartMotion(expr, false, expr->GetFadeInTime());
 }
 
 void Live2LOVE::loadMotion(const std::string& name, const std::pair<double, double>& fade, const void *buf, size_t size)
 {
+	// Loading registers IDs
+	waitAllSimulations();
+	waitSimulation();
 	initializeMotion();
 
 	// Load file
@@ -880,10 +2802,16 @@ void Live2LOVE::loadMotion(const std::string& name, const std::pair<double, doub
 		CubismMotion::Delete(motionList[name]);
 
 	motionList[name] = motion;
+
+	// Parsed again by clones
+	editDefinition().motions[name] = std::make_pair(std::make_shared<const std::string>((const char *) buf, size), fade);
 }
 
 void Live2LOVE::loadExpression(const std::string& name, const void *buf, size_t size)
 {
+	// Loading registers IDs
+	waitAllSimulations();
+	waitSimulation();
 	initializeExpression();
 
 	// Load file
@@ -895,10 +2823,16 @@ void Live2LOVE::loadExpression(const std::string& name, const void *buf, size_t
 		CubismExpressionMotion::Delete(expressionList[name]);
 
 	expressionList[name] = expr;
+
+	// Parsed again by clones
+	editDefinition().expressions[name] = std::make_shared<const std::string>((const char *) buf, size);
 }
 
 void Live2LOVE::loadPhysics(const void *buf, size_t size)
 {
+	// Loading registers IDs
+	waitAllSimulations();
+	waitSimulation();
 	// Load file
 	if (physics)
 		CubismPhysics::Delete(physics);
@@ -906,16 +2840,80 @@ void Live2LOVE::loadPhysics(const void *buf, size_t size)
 	physics = CubismPhysics::Create((csmByte *) buf, size);
 	if (physics == nullptr)
 		throw NamedException("Failed to load physics");
+
+	// Parsed again by clones
+	editDefinition().physics = std::make_shared<const std::string>((const char *) buf, size);
 }
 
 void Live2LOVE::loadPose(const void *buf, size_t size)
 {
+	// Loading registers IDs
+	waitAllSimulations();
+	waitSimulation();
 	if (pose)
 		CubismPose::Delete(pose);
 
 	pose = CubismPose::Create((csmByte *) buf, size);
 	if (pose == nullptr)
 		throw NamedException("Failed to load pose");
+
+	// Parsed again by clones
+	editDefinition().pose = std::make_shared<const std::string>((const char *) buf, size);
+}
+
+Live2LOVE::Definition &Live2LOVE::editDefinition()
+{
+	// Clones keep the definition they were created with
+	if (definition.use_count() > 1)
+		definition = std::make_shared<Definition>(*definition);
+
+	return *definition;
+}
+
+CubismMotion *Live2LOVE::getMotion(const std::string &name)
+{
+	auto parsed = motionList.find(name);
+	if (parsed != motionList.end())
+		return parsed->second;
+
+	auto data = definition->motions.find(name);
+	if (data == definition->motions.end())
+		return nullptr;
+
+	// Parsing registers IDs
+	waitAllSimulations();
+
+	const std::string &json = *data->second.first;
+	CubismMotion *motion = CubismMotion::Create((csmByte *) json.data(), json.size());
+	if (motion == nullptr)
+		throw NamedException("Failed to load motion");
+
+	motion->SetFadeInTime(data->second.second.first);
+	motion->SetFadeOutTime(data->second.second.second);
+	motionList[name] = motion;
+	return motion;
+}
+
+CubismExpressionMotion *Live2LOVE::getExpression(const std::string &name)
+{
+	auto parsed = expressionList.find(name);
+	if (parsed != expressionList.end())
+		return parsed->second;
+
+	auto data = definition->expressions.find(name);
+	if (data == definition->expressions.end())
+		return nullptr;
+
+	// Parsing registers IDs
+	waitAllSimulations();
+
+	const std::string &json = *data->second;
+	CubismExpressionMotion *expr = CubismExpressionMotion::Create((csmByte *) json.data(), json.size());
+	if (expr == nullptr)
+		throw NamedException("Failed to load expression");
+
+	expressionList[name] = expr;
+	return expr;
 }
 
 void Live2LOVE::initializeMotion()
@@ -932,6 +2930,7 @@ void Live2LOVE::initializeExpression()
 
 void Live2LOVE::loadEyeBlink(const std::vector<std::string> &names)
 {
+	waitSimulation();
 	if (!eyeBlink)
 		eyeBlink = CubismEyeBlink::Create();
 
@@ -945,6 +2944,7 @@ void Live2LOVE::loadEyeBlink(const std::vector<std::string> &names)
 
 void Live2LOVE::loadEyeBlink()
 {
+	waitSimulation();
 	if (!eyeBlink)
 		eyeBlink = CubismEyeBlink::Create();
 
@@ -963,6 +2963,7 @@ void Live2LOVE::loadEyeBlink()
 
 void Live2LOVE::loadBreath(const std::vector<Live2LOVEBreath> &names)
 {
+	waitSimulation();
 	if (!breath)
 		breath = CubismBreath::Create();
 
@@ -982,6 +2983,7 @@ void Live2LOVE::loadBreath(const std::vector<Live2LOVEBreath> &names)
 
 void Live2LOVE::loadBreath()
 {
+	waitSimulation();
 	if (!breath)
 		breath = CubismBreath::Create();
 
@@ -1010,7 +3012,7 @@ int Live2LOVE::drawStencil(lua_State *L)
 	lua_checkstack(L, 11);
 
 	// Call love.graphics.draw(all upvalues unpacked)
-	RefData::getRef(L, "love.graphics.draw");
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_DRAW);
 
 	for (int i = 1; i <= 10; i++)
 		lua_pushvalue(L, lua_upvalueindex(i));
@@ -1020,23 +3022,340 @@ int Live2LOVE::drawStencil(lua_State *L)
 	return 0;
 }
 
-void Live2LOVE::drawStencil(Live2LOVEMesh *mesh, DrawCoordinates &drawInfo, int depth)
+int Live2LOVE::drawStencilInstanced(lua_State *L)
+{
+	lua_checkstack(L, 3);
+
+	// Call love.graphics.drawInstanced(mesh, instances)
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_DRAWINSTANCED);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_pushvalue(L, lua_upvalueindex(2));
+	lua_call(L, 2, 0);
+
+	return 0;
+}
+
+void Live2LOVE::sendClipVector(const char *name, const float *value)
+{
+	RefData::getRef(L, clipShaderRef);
+	lua_getfield(L, -1, "send");
+	lua_insert(L, -2);
+	lua_pushstring(L, name);
+	RefData::getRef(L, clipVectorRef);
+
+	for (int i = 0; i < 4; i++)
+	{
+		lua_pushnumber(L, value[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	lua_call(L, 3, 0);
+}
+
+void Live2LOVE::drawMaskCanvas()
+{
+	// Masks are drawn without any transformation to the mask canvas
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_PUSH);
+	lua_pushstring(L, "all");
+	lua_call(L, 1, 0);
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_ORIGIN);
+	lua_call(L, 0, 0);
+
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_SETCANVAS);
+	RefData::getRef(L, maskCanvasRefID);
+	lua_call(L, 1, 0);
+
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_CLEAR);
+	for (int i = 0; i < 4; i++)
+		lua_pushnumber(L, 0);
+	lua_call(L, 4, 0);
+
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSHADER);
+	RefData::getRef(L, stencilFragRef);
+	lua_call(L, 1, 0);
+
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_SETBLENDMODE);
+	lua_pushstring(L, "replace");
+	lua_pushstring(L, "premultiplied");
+	lua_call(L, 2, 0);
+
+	const float size = (float) maskCanvasSize;
+
+	for (int index: usedMaskSets)
+	{
+		const Live2LOVEMaskSet &maskSet = maskSets[index];
+
+		if (maskSet.empty)
+			continue;
+
+		// Only write to the mask channel
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_SETCOLORMASK);
+		for (int i = 0; i < 4; i++)
+			lua_pushboolean(L, i == maskSet.channel);
+		lua_call(L, 4, 0);
+
+		// Don't leak to other regions
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSCISSOR);
+		lua_pushnumber(L, floor(maskSet.region[0] * size));
+		lua_pushnumber(L, floor(maskSet.region[1] * size));
+		lua_pushnumber(L, floor(maskSet.region[2] * size));
+		lua_pushnumber(L, floor(maskSet.region[3] * size));
+		lua_call(L, 4, 0);
+
+		// Masks of masks are ignored here, same as Cubism renderers.
+		for (auto mask: maskSet.masks)
+		{
+			if (mask->indexCount == 0)
+				continue;
+
+			RefData::getRef(L, RefData::LOVE_GRAPHICS_DRAW);
+			pushMesh(mask);
+			lua_pushnumber(L, maskSet.transform[2]);
+			lua_pushnumber(L, maskSet.transform[3]);
+			lua_pushnumber(L, 0);
+			lua_pushnumber(L, maskSet.transform[0]);
+			lua_pushnumber(L, maskSet.transform[1]);
+			lua_call(L, 6, 0);
+		}
+	}
+
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_POP);
+	lua_call(L, 0, 0);
+
+	// Clip shader is shared by all models
+	RefData::getRef(L, clipShaderRef);
+	lua_getfield(L, -1, "send");
+	lua_insert(L, -2);
+	lua_pushstring(L, "clipMask");
+	RefData::getRef(L, maskCanvasRefID);
+	lua_call(L, 3, 0);
+}
+
+void Live2LOVE::setClippingMode(ClipModeID mode, int size)
+{
+	// Mask bounds are updated below
+	waitSimulation();
+
+	if (mode == CLIP_CANVAS)
+	{
+		// Initialize clip shader
+		if (clipShaderRef == LUA_REFNIL)
+		{
+			RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWSHADER);
+			lua_pushstring(L, clipShader);
+			if (lua_pcall(L, 1, 1, 0) != 0)
+			{
+				NamedException temp(lua_tostring(L, -1));
+				lua_pop(L, 1);
+				throw temp;
+			}
+			clipShaderRef = RefData::setRef(L, -1);
+			lua_pop(L, 1);
+
+			lua_createtable(L, 4, 0);
+			clipVectorRef = RefData::setRef(L, -1);
+			lua_pop(L, 1);
+		}
+
+		if (size <= 0)
+			throw NamedException("Invalid mask canvas size");
+
+		if (size != maskCanvasSize)
+		{
+			RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWCANVAS);
+			lua_pushinteger(L, size);
+			lua_pushinteger(L, size);
+			if (lua_pcall(L, 2, 1, 0) != 0)
+			{
+				NamedException temp(lua_tostring(L, -1));
+				lua_pop(L, 1);
+				throw temp;
+			}
+
+			RefData::delRef(L, maskCanvasRefID);
+			maskCanvasRefID = RefData::setRef(L, -1);
+			lua_pop(L, 1);
+			maskCanvasSize = size;
+		}
+	}
+	else
+	{
+		RefData::delRef(L, maskCanvasRefID);
+		maskCanvasRefID = LUA_NOREF;
+		maskCanvasSize = 0;
+	}
+
+	clipMode = mode;
+	updateMaskSets();
+	compileDrawCommands();
+}
+
+std::pair<ClipModeID, int> Live2LOVE::getClippingMode() const
+{
+	return std::pair<ClipModeID, int>(clipMode, maskCanvasSize);
+}
+
+void Live2LOVE::setRenderCache(bool enable)
+{
+	renderCache = enable;
+	cacheValid = false;
+
+	if (!enable)
+	{
+		RefData::delRef(L, cacheCanvasRefID);
+		cacheCanvasRefID = LUA_NOREF;
+		cacheCanvasSize[0] = cacheCanvasSize[1] = 0;
+	}
+}
+
+bool Live2LOVE::isRenderCache() const
+{
+	return renderCache;
+}
+
+bool Live2LOVE::drawCache(const DrawCoordinates &di)
+{
+	const float padding = 2.0f;
+	const int maxSize = 4096;
+
+	// Cache is rendered at draw scale
+	float scale = (float) std::max(fabs(di.sx), fabs(di.sy));
+	int width = (int) ceil((bounds[2] - bounds[0]) * scale + padding * 2.0f);
+	int height = (int) ceil((bounds[3] - bounds[1]) * scale + padding * 2.0f);
+
+	if (scale <= 0.0f || width > maxSize || height > maxSize)
+		return false;
+
+	if (!cacheValid || scale != cacheScale)
+	{
+		// Reuse canvas unless it's too small or much larger than needed
+		if (width > cacheCanvasSize[0] || height > cacheCanvasSize[1] ||
+			(width * 2 < cacheCanvasSize[0] && height * 2 < cacheCanvasSize[1]))
+		{
+			RefData::delRef(L, cacheCanvasRefID);
+			cacheCanvasRefID = LUA_NOREF;
+
+			RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWCANVAS);
+			lua_pushinteger(L, width);
+			lua_pushinteger(L, height);
+			if (lua_pcall(L, 2, 1, 0) != 0)
+			{
+				NamedException temp(lua_tostring(L, -1));
+				lua_pop(L, 1);
+				throw temp;
+			}
+
+			cacheCanvasRefID = RefData::setRef(L, -1);
+			lua_pop(L, 1);
+			cacheCanvasSize[0] = width;
+			cacheCanvasSize[1] = height;
+		}
+
+		// Draw without any user state to the cache canvas
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_PUSH);
+		lua_pushstring(L, "all");
+		lua_call(L, 1, 0);
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_RESET);
+		lua_call(L, 0, 0);
+
+		// Call love.graphics.setCanvas({canvas, stencil = true})
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_SETCANVAS);
+		lua_createtable(L, 1, 1);
+		RefData::getRef(L, cacheCanvasRefID);
+		lua_rawseti(L, -2, 1);
+		lua_pushboolean(L, 1);
+		lua_setfield(L, -2, "stencil");
+		lua_call(L, 1, 0);
+
+		// Clears stencil too
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_CLEAR);
+		for (int i = 0; i < 4; i++)
+			lua_pushnumber(L, 0);
+		lua_call(L, 4, 0);
+
+		cacheOrigin[0] = bounds[0];
+		cacheOrigin[1] = bounds[1];
+		DrawCoordinates cacheInfo {
+			padding - cacheOrigin[0] * scale, padding - cacheOrigin[1] * scale, 0,
+			scale, scale, 0, 0, 0, 0
+		};
+		double screenBounds[4];
+		getScreenBounds(cacheInfo, bounds, screenBounds);
+		drawModel(cacheInfo, screenBounds);
+
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_POP);
+		lua_call(L, 0, 0);
+
+		cacheValid = true;
+		cacheScale = scale;
+	}
+
+	// Save blending
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_SETBLENDMODE);
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_GETBLENDMODE);
+	lua_call(L, 0, 2);
+
+	// Canvas has premultiplied alpha
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_SETBLENDMODE);
+	lua_pushstring(L, "alpha");
+	lua_pushstring(L, "premultiplied");
+	lua_call(L, 2, 0);
+
+	// Save color. The color has to be premultiplied too, or alpha of the
+	// color no longer fades the model.
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_SETCOLOR);
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_GETCOLOR);
+	lua_call(L, 0, 4);
+	int colorIndex = lua_gettop(L) - 3;
+	double alpha = lua_tonumber(L, colorIndex + 3);
+
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_SETCOLOR);
+	for (int i = 0; i < 3; i++)
+		lua_pushnumber(L, lua_tonumber(L, colorIndex + i) * alpha);
+	lua_pushnumber(L, alpha);
+	lua_call(L, 4, 0);
+
+	// Canvas pixel c is model position (c - padding) / scale + cacheOrigin,
+	// so scale and origin are adjusted to match the model draw.
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_DRAW);
+	RefData::getRef(L, cacheCanvasRefID);
+	lua_pushnumber(L, di.x);
+	lua_pushnumber(L, di.y);
+	lua_pushnumber(L, di.r);
+	lua_pushnumber(L, di.sx / scale);
+	lua_pushnumber(L, di.sy / scale);
+	lua_pushnumber(L, (di.ox - cacheOrigin[0]) * scale + padding);
+	lua_pushnumber(L, (di.oy - cacheOrigin[1]) * scale + padding);
+	lua_pushnumber(L, di.kx);
+	lua_pushnumber(L, di.ky);
+	lua_call(L, 10, 0);
+
+	// Reset color and blend mode
+	lua_call(L, 4, 0);
+	lua_call(L, 2, 0);
+	return true;
+}
+
+void Live2LOVE::drawStencil(Live2LOVEMesh *mesh, const DrawCoordinates &drawInfo, int base, int depth, int instances)
 {
 	for (Live2LOVEMesh *x: mesh->clipID)
 	{
+		if (x->indexCount == 0)
+			continue;
+
 		bool hasMask = x->clipID.size() > 0;
 
 		if (hasMask)
-			drawStencil(x, drawInfo, depth + 1);
+			drawStencil(x, drawInfo, base, depth + 1, instances);
 
 		// Call love.graphics.setStencilTest
-		RefData::getRef(L, "love.graphics.setStencilTest");
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_SETSTENCILTEST);
 
 		if (hasMask)
 		{
-			// love.graphics.setStencilTest("equal", depth + 1);
-			lua_pushlstring(L, "equal", 4);
-			lua_pushinteger(L, depth + 1);
+			// love.graphics.setStencilTest("equal", base + depth);
+			lua_pushlstring(L, "equal", 5);
+			lua_pushinteger(L, base + depth);
 		}
 		else
 		{
@@ -1047,13 +3366,23 @@ void Live2LOVE::drawStencil(Live2LOVEMesh *mesh, DrawCoordinates &drawInfo, int
 
 		lua_call(L, 2, 0);
 
-		// Call love.graphics.stencil(drawStencil and 10 upvalues, "replace", depth, true);
-		RefData::getRef(L, "love.graphics.stencil");
-		RefData::getRef(L, x->meshRefID);
-		pushDrawCoordinates(L, drawInfo);
-		lua_pushcclosure(L, drawStencil, 10);
+		// Call love.graphics.stencil(drawStencil and 10 upvalues, "replace", base + depth - 1, true);
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_STENCIL);
+		pushMesh(x);
+
+		if (instances > 0)
+		{
+			lua_pushinteger(L, instances);
+			lua_pushcclosure(L, drawStencilInstanced, 2);
+		}
+		else
+		{
+			pushDrawCoordinates(L, drawInfo);
+			lua_pushcclosure(L, drawStencil, 10);
+		}
+
 		lua_pushlstring(L, "replace", 7);
-		lua_pushinteger(L, depth);
+		lua_pushinteger(L, base + depth - 1);
 		lua_pushboolean(L, 1);
 		lua_call(L, 4, 0);
 	}
@@ -1062,7 +3391,7 @@ void Live2LOVE::drawStencil(Live2LOVEMesh *mesh, DrawCoordinates &drawInfo, int
 int Live2LOVE::setupPMATexture(int width, int height, int imageIndex)
 {
 	// Create new Canvas same as the width and height of the image
-	RefData::getRef(L, "love.graphics.newCanvas");
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWCANVAS);
 	lua_pushinteger(L, width);
 	lua_pushinteger(L, height);
 	lua_createtable(L, 0, 2);
@@ -1077,30 +3406,30 @@ int Live2LOVE::setupPMATexture(int width, int height, int imageIndex)
 	lua_call(L, 3, 1);
 
 	// Push all graphics state
-	RefData::getRef(L, "love.graphics.push");
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_PUSH);
 	lua_pushlstring(L, "all", 3);
 	lua_call(L, 1, 0);
 
 	// Reset graphics state
-	RefData::getRef(L, "love.graphics.reset");
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_RESET);
 	lua_call(L, 0, 0);
 
 	// Set canvas
-	RefData::getRef(L, "love.graphics.setCanvas");
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_SETCANVAS);
 	lua_pushvalue(L, -2);
 	lua_call(L, 1, 0);
 
 	// Clear canvas
-	RefData::getRef(L, "love.graphics.clear");
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_CLEAR);
 	lua_call(L, 0, 0);
 
 	// Draw image
-	RefData::getRef(L, "love.graphics.draw");
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_DRAW);
 	lua_pushvalue(L, imageIndex);
 	lua_call(L, 1, 0);
 
 	// Pop graphics state
-	RefData::getRef(L, "love.graphics.pop");
+	RefData::getRef(L, RefData::LOVE_GRAPHICS_POP);
 	lua_call(L, 0, 0);
 
 	return lua_gettop(L);
@@ -22,6 +22,7 @@
 #define _L2L_LIVE2LOVE_
 
 // STL
+#include <atomic>
 #include <exception>
 #include <map>
 #include <memory>
@@ -48,6 +49,9 @@ extern "C" {
 #include "Motion/CubismMotionManager.hpp"
 #include "Physics/CubismPhysics.hpp"
 
+// ThreadPool
+#include "ThreadPool.h"
+
 namespace live2love
 {
 	using namespace Live2D::Cubism::Core;
@@ -62,10 +66,41 @@ namespace live2love
 		MOTION_MAX_ENUM
 	};
 
-	// Default LOVE mesh format
+	enum MeshModeID {
+		MESH_SEPARATE,
+		MESH_SHARED,
+		MESH_MAX_ENUM
+	};
+
+	enum ClipModeID {
+		CLIP_STENCIL,
+		CLIP_CANVAS,
+		CLIP_MAX_ENUM
+	};
+
+	// Parameter operations of batch parameter functions
+	enum ParamOpID {
+		PARAM_SET,
+		PARAM_SET_POST,
+		PARAM_ADD,
+		PARAM_MUL,
+		PARAM_MAX_ENUM
+	};
+
+	// Vertex format of the drawable Mesh objects. Texture coordinates don't
+	// change, so they're in a separate Mesh attached to it.
 	struct Live2LOVEMeshFormat
 	{
-		float x, y, u, v;
+		float x, y;
+		unsigned char r, g, b, a;
+	};
+
+	// Per-instance attributes of instanced drawing. x and y are the rows of
+	// the instance transformation.
+	struct Live2LOVEInstanceFormat
+	{
+		float x[3], y[3];
+		float group;
 		unsigned char r, g, b, a;
 	};
 
@@ -85,18 +120,101 @@ namespace live2love
 		// Model object
 		CubismModel *model;
 		// Mesh object reference and mesh table reference
+		// (LUA_NOREF in shared mesh mode)
 		int meshRefID, tableRefID;
 		Live2LOVEMeshFormat *tablePointer;
+		// Vertex offset, index offset and amount of indices in shared mesh
+		int vertexOffset, indexOffset, indexCount;
+		// Vertices are changed but not yet uploaded
+		bool needUpload;
+		// Fixed timestep or update interval: vertices differ between previous
+		// and current state, and state changed since last vertex update
+		bool interpolate, stateChanged;
+		// Drawable is visible and not fully transparent
+		bool visible;
+		// Drawable is used as mask by other drawables
+		bool isMask;
+		// Vertices changed while invisible and not transformed
+		bool positionStale;
+		// Bounding box of the vertices (minX, minY, maxX, maxY)
+		float bounds[4];
+		// Index of mask set in Live2LOVE::maskSets, or -1 if not masked
+		int maskSet;
 		// Clip ID mesh
 		std::vector<Live2LOVEMesh*> clipID;
 	};
 
+	enum DrawCommandType {
+		// Draw mesh
+		DRAW_MESH,
+		// Set blend mode of the mesh
+		DRAW_BLEND,
+		// Draw masks of the mesh to unused stencil values and enable stencil test
+		DRAW_MASK_BEGIN,
+		// Enable stencil test, stencil buffer has the masks of the mesh
+		DRAW_MASK_RESUME,
+		// Disable stencil test
+		DRAW_MASK_END,
+		// Set clip shader with mask set of the mesh
+		DRAW_CLIP_BEGIN,
+		// Restore shader
+		DRAW_CLIP_END
+	};
+
+	// Drawables which are clipped by identical list of masks
+	struct Live2LOVEMaskSet
+	{
+		// Mask drawables, ordered by drawable index
+		std::vector<Live2LOVEMesh*> masks;
+		// Mask canvas channel (0-3 for RGBA), or -1 if it doesn't fit
+		int channel;
+		// Region in the mask canvas (x, y, w, h, normalized)
+		float region[4];
+		// Scale (x, y) and offset (x, y) from model position to mask canvas
+		// pixel, computed by upload
+		float transform[4];
+		// Bounding box of the masks (minX, minY, maxX, maxY), computed by
+		// upload
+		float bounds[4];
+		// Mask drawables have nothing to draw
+		bool empty;
+		// Amount of stencil values used by (nested) masks
+		int depth;
+	};
+
+	// Draw command compiled from draw order
+	struct Live2LOVEDrawCommand
+	{
+		DrawCommandType type;
+		Live2LOVEMesh *mesh;
+		// Index range of DRAW_MESH, which may span multiple drawables
+		int indexStart, indexCount;
+	};
+
+	// Live2LOVE statistics of last update
+	struct Live2LOVEStats
+	{
+		// Amount of drawables which vertices are uploaded
+		int uploadedDrawables;
+		// Amount of drawables which are invisible or fully transparent
+		int hiddenDrawables;
+		// Amount of draw calls of drawables (excluding masks)
+		int drawCalls;
+	};
+
 	struct Live2LOVEParamDef
 	{
 		std::string name;
 		double min, max, def;
 	};
 
+	// Parameter to be set after update
+	struct Live2LOVEPostParam
+	{
+		int index;
+		float value, weight;
+	};
+
 	struct Live2LOVEBreath
 	{
 		std::string paramName;
@@ -125,9 +243,82 @@ namespace live2love
 			double x, y, r, sx, sy, ox, oy, kx, ky;
 		};
 
+		// Placement and tint color of drawInstanced instance
+		struct DrawInstance
+		{
+			DrawCoordinates coords;
+			float color[4];
+		};
+
+		// State of drawModel while replaying draw commands
+		struct DrawState
+		{
+			DrawCoordinates drawInfo;
+			// Instances drawn with love.graphics.drawInstanced, or 0
+			int instances;
+			// Instances are split to groups which don't overlap each other.
+			// Masked drawables are drawn once per group.
+			int instanceGroups;
+			// Screen bounds of the model, or null if unknown
+			const double *screenBounds;
+			// Scissor masks to their screen bounds
+			bool scissorMasks;
+			// Stencil buffer doesn't have the masks of DRAW_MASK_RESUME
+			bool redrawMasks;
+			// Lua stack indices of love.graphics.setBlendMode, saved shader,
+			// shader of drawables, saved scissor, love.graphics.draw and
+			// love.graphics.drawInstanced
+			int setBlendModeIndex, shaderIndex, drawShaderIndex, scissorIndex, drawIndex, drawInstancedIndex;
+			// Stencil values are rolling, so the stencil buffer is cleared
+			// only at start or when the values run out. Masks use values
+			// from stencilValue up to their depth, and masked drawables test
+			// against maskValue.
+			int stencilValue, maskValue;
+			// Screen bounds of current mask set, if scissorMasks
+			double maskBounds[4];
+			// Mask set currently used by clip shader
+			const Live2LOVEMaskSet *clipSet;
+			bool clipPremultiplied;
+			// Current blend mode
+			Rendering::CubismRenderer::CubismBlendMode blending;
+		};
+
+		// Background simulation of the next frame
+		struct SimulationTask: public ThreadPoolTask
+		{
+			Live2LOVE *owner;
+			double deltaT;
+			// Exception message thrown by simulate
+			std::string error;
+			void run() override;
+		};
+
+		// Texture coordinates of the drawables, shared by clones
+		struct UVData
+		{
+			lua_State *L;
+			// VertexTexCoord Mesh objects: one for all drawables in shared
+			// mesh mode, otherwise one per drawable
+			std::vector<int> meshRefID;
+			~UVData();
+		};
+
+		// Loaded JSON, shared by clones. Motions, expressions, physics and
+		// pose parsed by the Framework also hold their playback state, so
+		// every clone parses its own.
+		struct Definition
+		{
+			// Motion JSON and its fade in and fade out times
+			std::map<std::string, std::pair<std::shared_ptr<const std::string>, std::pair<double, double>>> motions;
+			std::map<std::string, std::shared_ptr<const std::string>> expressions;
+			std::shared_ptr<const std::string> physics, pose;
+		};
+
 		// This is pretty much self-explanatory
 		//uint8_t *mocFreeThis;
-		CubismMoc *moc;
+		std::shared_ptr<CubismMoc> moc;
+		std::shared_ptr<UVData> uvData;
+		std::shared_ptr<Definition> definition;
 		CubismModel *model;
 		CubismMotionManager *motion;
 		CubismMotionManager* expression;
@@ -136,15 +327,31 @@ namespace live2love
 		CubismBreath *breath;
 		CubismPose *pose;
 
-		// Mesh data list
+		// Mesh data list, ordered by drawable index
 		std::vector<Live2LOVEMesh*> meshData;
+		// Visible mesh data list, ordered by render order
+		std::vector<Live2LOVEMesh*> drawOrder;
+		// Draw order of all meshes computed by simulate, published to
+		// drawOrder by upload
+		std::vector<Live2LOVEMesh*> nextDrawOrder;
+		bool drawOrderChanged;
+		// Mesh mode (one Mesh per drawable or one Mesh for all drawables)
+		MeshModeID meshMode;
+		// Shared Mesh object reference and its vertex data reference
+		int sharedMeshRefID, sharedTableRefID;
+		Live2LOVEMeshFormat *sharedTablePointer;
+		// Texture currently set in shared Mesh object
+		int sharedTextureRefID;
+		// Texture and PMA texture references, used in shared mesh mode
+		std::vector<int> textureRefID, pmaTextureRefID;
 		// List of textures needing PMA
 		std::vector<bool> needPMATexture;
 		// Mesh data map (use sparingly)
 		std::map<std::string, Live2LOVEMesh*> meshDataMap;
-		// List of motions (movement)
+		// List of parsed motions (movement). Clones parse motions of the
+		// definition when they're first started.
 		std::map<std::string, CubismMotion*> motionList;
-		// List of expressions
+		// List of parsed expressions, same as above
 		std::map<std::string, CubismExpressionMotion*> expressionList;
 
 		// Lua state
@@ -156,23 +363,151 @@ namespace live2love
 		// Loop motion name
 		std::string motionLoop;
 		// Parameter update list
-		std::map<std::string, std::pair<double, double>*> postParamUpdateList;
+		std::vector<Live2LOVEPostParam> postParamUpdateList;
+		// Position of parameter index in postParamUpdateList, or -1
+		std::vector<int> postParamSlot;
 		// Model width and height
 		float modelWidth, modelHeight;
 		// Model offset
 		float modelOffX, modelOffY;
 		// Model pixel units
 		float modelPixelUnits;
+		// Upload all vertices on next update regardless of dynamic flags
+		bool forceMeshUpdate;
+		// Vertex range which needs to be uploaded (vertexOffset based)
+		int dirtyStart, dirtyEnd;
+		// Data view of the shared vertex data used by last upload, and its
+		// vertex range. Kept as long as the same range is uploaded.
+		int uploadViewRefID;
+		int uploadViewStart, uploadViewEnd;
+		// Statistics, and statistics computed by simulate published by upload
+		Live2LOVEStats stats, nextStats;
+		// Simulate next frame in background on update
+		bool pipelined;
+		// Fixed simulation timestep in seconds (0 = variable), maximum steps
+		// per update, and time not yet simulated
+		double fixedTimestep;
+		int maxSubsteps;
+		double timeAccumulator;
+		// Last update used fixed timestep or update interval
+		bool stepped;
+		// Simulate every updateInterval updates (maximum interval if
+		// automatic), and updates since last simulation
+		int updateInterval, frameCounter;
+		// Draw scale where automatic update interval is 1 (0 = disabled)
+		double autoIntervalScale;
+		// Largest scale factor of last draw, written by draw
+		std::atomic<float> drawScale;
+		// Bounding box of visible drawables, and the one computed by simulate
+		// published by upload (minX, minY, maxX, maxY)
+		float bounds[4], nextBounds[4];
+		// Skip drawing if the model is outside this screen rectangle
+		// (minX, minY, maxX, maxY)
+		bool cullEnabled;
+		double cullRect[4];
+		// Draw commands of drawOrder, replayed by draw
+		std::vector<Live2LOVEDrawCommand> drawCommands;
+		bool hasMaskCommands;
+		// Merge draws of consecutive drawables (shared mesh mode only)
+		bool batching;
+		// Mask sets of the drawables
+		std::vector<Live2LOVEMaskSet> maskSets;
+		// Clipping mode, mask canvas size and its reference
+		ClipModeID clipMode;
+		int maskCanvasSize, maskCanvasRefID;
+		// Mask sets used by drawCommands
+		std::vector<int> usedMaskSets;
+		bool hasClipCommands;
+		// Visible drawables use other than normal blending
+		bool hasBlendCommands;
+		// Canvas which has the model drawn at cacheScale, reused until the
+		// model changes (render cache mode). Not used while hasBlendCommands,
+		// as such drawables must blend with the real background.
+		bool renderCache;
+		int cacheCanvasRefID;
+		int cacheCanvasSize[2];
+		bool cacheValid;
+		float cacheScale;
+		float cacheOrigin[2];
+		// Per-instance attribute Mesh of drawInstanced, which is attached to
+		// the drawable Mesh objects, and its vertex data
+		int instanceMeshRefID, instanceTableRefID;
+		Live2LOVEInstanceFormat *instanceTablePointer;
+		int instanceCapacity;
+		// Model space vertices and opacities of previous and current
+		// simulation step (vertexOffset based), and interpolation buffer
+		std::vector<csmVector2> prevVertices, currVertices, lerpVertices;
+		std::vector<float> prevOpacity, currOpacity;
+		mutable SimulationTask simulationTask;
 
 		// glBlendFuncSeparate
 		static glBlendFuncSeparate_t glBlendFuncSeparate;
 		static bool glBlendFuncSeparateAttempted;
+		// Update deformation before post-update parameters too, like older
+		// versions did. Only used to benchmark the difference.
+		static std::atomic<bool> doubleUpdate;
 
 		// Create new Live2LOVE object. Only load moc file
-		Live2LOVE(lua_State *L, const void *buf, size_t size);
+		Live2LOVE(lua_State *L, const void *buf, size_t size, MeshModeID meshMode = MESH_SEPARATE);
 		~Live2LOVE();
+		// Create new model object which shares moc and textures with this
+		// one, but has its own parameter state, motions and physics.
+		Live2LOVE *clone() const;
 		// Update model. deltaT should be in seconds.
 		void update(double deltaT);
+		// Update model without uploading vertices. This doesn't touch Lua,
+		// so different models can be simulated in different threads.
+		void simulate(double deltaT);
+		// Upload vertices changed by simulate. Must be called from Lua thread.
+		void upload();
+		// Enable/disable simulating next frame in background on update.
+		// Model is drawn one frame behind when enabled.
+		void setPipelined(bool pipelined);
+		bool isPipelined() const;
+		// Wait until background simulation finishes
+		void waitSimulation() const;
+		// Wait until background simulations of all models finish. The Cubism
+		// ID manager isn't thread-safe and motions look up IDs while they're
+		// simulated, so this must be called before anything which can
+		// register new IDs: creating models, loading motions, expressions,
+		// physics, pose, eye blink, and breath, and parameter functions by
+		// name.
+		static void waitAllSimulations();
+		// Simulate at fixed rate (in Hz) with at most substeps steps per
+		// update, interpolating vertices between the last two steps.
+		// rate of 0 disables it.
+		void setSimulationRate(double rate, int substeps = 4);
+		std::pair<double, int> getSimulationRate() const;
+		// Simulate once every interval updates, interpolating vertices in
+		// between. Ignored if simulation rate is set.
+		void setUpdateInterval(int interval);
+		// Pick update interval (up to maxInterval) based on scale of last
+		// draw. Drawing at fullScale or larger uses interval of 1.
+		void setAutoUpdateInterval(double fullScale, int maxInterval);
+		// Get update interval used in next update
+		int getUpdateInterval() const;
+		// Get bounding box of visible drawables, in model coordinates.
+		// Min is larger than max if nothing is visible.
+		std::pair<float, float> getBoundsMin() const;
+		std::pair<float, float> getBoundsMax() const;
+		// Set screen rectangle where the model is drawn. Models completely
+		// outside of it are not drawn.
+		void setCullRect(double x, double y, double w, double h);
+		// Disable culling
+		void setCullRect();
+		// Enable/disable merging draws of consecutive drawables with same
+		// texture and blend mode. Requires shared mesh mode.
+		void setBatching(bool batch);
+		bool isBatching() const;
+		// Set clipping mode. CLIP_CANVAS draws masks to size x size mask
+		// canvas once per draw and masked drawables sample it.
+		void setClippingMode(ClipModeID mode, int size = 512);
+		std::pair<ClipModeID, int> getClippingMode() const;
+		// Enable/disable drawing the model to a cache canvas, which is drawn
+		// again as long as the model doesn't change. Only models with normal
+		// blending are cached.
+		void setRenderCache(bool enable);
+		bool isRenderCache() const;
 		// Draw model using LOVE renderer
 		void draw(
 			double x = 0, double y = 0, double r = 0,
@@ -180,6 +515,10 @@ namespace live2love
 			double ox = 0, double oy = 0,
 			double kx = 0, double ky = 0
 		);
+		// Draw same pose of the model at multiple placements with instanced
+		// draw calls. Instances which don't overlap each other share their
+		// mask passes.
+		void drawInstanced(const std::vector<DrawInstance> &instances);
 		// Set texture to user-supplied LOVE Texture
 		void setTexture(int live2dtexno, int loveimageidx);
 		// Disable/enable animation movement (physics & dynamic move over time)
@@ -196,6 +535,18 @@ namespace live2love
 		void mulParamValue(const std::string& name, double value, double weight = 1);
 		// Get parameter value. This value is updated after the model is updated.
 		double getParamValue(const std::string& name) const;
+		// Get parameter index, or -1 if the model doesn't have the parameter
+		int getParamIndex(const std::string& name) const;
+		int getParamIndex(const char *name) const;
+		// Same as above, but using parameter index from getParamIndex
+		void setParamValue(int index, double value, double weight = 1);
+		void setParamValuePost(int index, double value, double weight = 1);
+		void addParamValue(int index, double value, double weight = 1);
+		void mulParamValue(int index, double value, double weight = 1);
+		double getParamValue(int index) const;
+		// Apply op to parameters by index (value and weight of each), waiting
+		// for background simulation only once
+		void applyParams(ParamOpID op, const std::vector<Live2LOVEPostParam> &params);
 		// Get parameter information list
 		std::vector<Live2LOVEParamDef> getParamInfoList();
 		// Get animation movement status
@@ -234,19 +585,118 @@ namespace live2love
 		std::pair<float, float> getModelCenterPosition();
 
 	private:
+		// Create new Live2LOVE object from already loaded moc. sharedUV can
+		// be null if it's not loaded yet.
+		Live2LOVE(lua_State *L, std::shared_ptr<CubismMoc> sharedMoc, std::shared_ptr<UVData> sharedUV, MeshModeID meshMode);
+		// Load moc, which can be shared between models
+		static std::shared_ptr<CubismMoc> createMoc(const void *buf, size_t size);
 		// Mesh data initialization
 		void setupMeshData();
+		// Mesh data initialization, one Mesh per drawable
+		void setupSeparateMeshData();
+		// Mesh data initialization, one Mesh for all drawables
+		void setupSharedMeshData(int vertexCount, int indexCount);
+		// Create UV Mesh objects of the drawables
+		void setupUVData(int vertexCount);
+		// Create new vertex Mesh object with texture coordinates from UV Mesh
+		// at uvIndex. +1 at Lua stack
+		void pushNewMesh(int vertexCount, int uvIndex);
+		// Definition to be changed, copied first if clones share it
+		Definition &editDefinition();
+		// Get parsed motion, parsing it from the definition if needed. Returns
+		// null if there's no such motion.
+		CubismMotion *getMotion(const std::string &name);
+		// Same as above, for expressions
+		CubismExpressionMotion *getExpression(const std::string &name);
+		// Update model parameters and deformation
+		void updateParameters(double deltaT);
+		// Forget post-update parameters which are applied
+		void clearPostParams();
+		// Update vertex data and render order from model deformation
+		void updateVertices();
+		// Fixed timestep or update interval update
+		void simulateStepped(double deltaT, int interval);
+		// Free interpolation buffers if neither fixed timestep nor update
+		// interval is used
+		void releaseStepState();
+		// Discard interpolation state and restart stepping from the current
+		// model state on next simulate
+		void restartStepState();
+		// Store simulation step result for interpolation
+		void captureState(bool force);
+		// Update vertex data from interpolated simulation state
+		void updateInterpolatedVertices(float alpha);
+		// Queue parameter to be set on next update. Indices outside the model
+		// parameters are ignored.
+		void queuePostParam(int index, float value, float weight);
+		// Rebuild nextDrawOrder from the model render orders
+		void updateDrawOrder();
+		// Set mesh visibility, updating draw order if needed
+		void setVisible(Live2LOVEMesh *mesh, bool visible);
+		// Update hidden drawables statistic and model bounds
+		void updateVisibilityInfo();
+		// Transform model space bounds to screen bounds (minX, minY, maxX, maxY).
+		// Returns false if bounds are empty.
+		bool getScreenBounds(const DrawCoordinates &drawInfo, const float *bounds, double *screenBounds);
+		// Draw model with draw commands. screenBounds can be null if unknown.
+		// If instances is not 0, instance attributes are used instead of
+		// drawInfo.
+		void drawModel(const DrawCoordinates &drawInfo, const double *screenBounds, int instances = 0, int instanceGroups = 1);
+		// Set blend mode of drawables
+		void setBlending(int setBlendModeIndex, Rendering::CubismRenderer::CubismBlendMode blending);
+		// Replay draw commands from begin to end
+		void replayCommands(DrawState &state, size_t begin, size_t end);
+		// Replay masked draw commands from begin to end once for every
+		// instance group, with the masks of the group
+		void drawMaskedInstances(DrawState &state, size_t begin, size_t end);
+		// Only draw instances of the group, or all instances if negative
+		void setInstanceGroup(int group);
+		// Create instancing shader, and make sure per-instance attribute Mesh
+		// has room for count instances
+		void setupInstancing(int count);
+		// Draw cache canvas, rendering it first if needed. Returns false if
+		// the model is too large to be cached.
+		bool drawCache(const DrawCoordinates &drawInfo);
+		// Restore scissor saved at scissorIndex (4 values) and intersect it
+		// with screen bounds, if any
+		void setScissor(int scissorIndex, const double *screenBounds);
+		// Clear stencil buffer inside screen bounds
+		void clearStencil(int scissorIndex, const double *screenBounds);
+		// Reset bounding box to empty
+		static void clearBounds(float *bounds);
+		// Copy visible meshes from nextDrawOrder to drawOrder
+		void publishDrawOrder();
+		// Compile drawOrder to drawCommands
+		void compileDrawCommands();
+		// Push Mesh object of the drawable, ready to be drawn. +1 at Lua stack
+		void pushMesh(Live2LOVEMesh *mesh);
+		// Same as above, but with specified index range in shared mesh mode
+		void pushMesh(Live2LOVEMesh *mesh, int indexStart, int indexCount);
+		// Set index map of shared mesh, placing indices in specified order
+		void updateVertexMap(const std::vector<Live2LOVEMesh*> &order);
 		// Expression initialize
 		void initializeExpression();
 		// Motion initializaiton
 		void initializeMotion();
-		// Stencil drawing main loop
-		void drawStencil(Live2LOVEMesh *mesh, DrawCoordinates &drawPosition, int depth);
+		// Group drawables by mask list and layout the mask canvas
+		void setupMaskSets();
+		// Update mask set bounds and fit them in their mask canvas regions
+		void updateMaskSets();
+		// Draw used mask sets to mask canvas
+		void drawMaskCanvas();
+		// Send vec4 to clip shader
+		void sendClipVector(const char *name, const float *value);
+		// Amount of stencil values needed to draw mask and its masks
+		static int getStencilDepth(Live2LOVEMesh *mesh);
+		// Stencil drawing main loop. Masks are drawn with values starting
+		// from base. If instances is not 0, masks are drawn instanced.
+		void drawStencil(Live2LOVEMesh *mesh, const DrawCoordinates &drawPosition, int base, int depth, int instances = 0);
 		// Setup PMA texture
 		int setupPMATexture(int width, int height, int imageIndex);
 
 		// Stencil drawing Lua function
 		static int drawStencil(lua_State *L);
+		static int drawStencilInstanced(lua_State *L);
 	};
 }
 
@@ -25,6 +25,11 @@ extern "C" {
 #include "lauxlib.h"
 }
 
+// STL
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
 // Live2LOVE
 #include "Live2LOVE.h"
 using namespace live2love;
@@ -35,6 +40,9 @@ using namespace live2love;
 // RefData
 #include "RefData.h"
 
+// ThreadPool
+#include "ThreadPool.h"
+
 #define L2L_TRYWRAP(expr) {try { expr } catch(std::exception &x) { lua_settop(L, 0); luaL_error(L, x.what()); }}
 
 class Live2LOVEAllocator: public Live2D::Cubism::Framework::ICubismAllocator
@@ -137,7 +145,7 @@ const void *argToData(lua_State *L, int idx, size_t &size)
 			}
 		}
 
-		RefData::getRef(L, "love.filesystem.read");
+		RefData::getRef(L, RefData::LOVE_FILESYSTEM_READ);
 		lua_pushstring(L, "data");
 		lua_pushvalue(L, idx);
 		lua_call(L, 2, 2);
@@ -313,6 +321,339 @@ int Live2LOVE_getParamValue(lua_State *L)
 	return 1;
 }
 
+// Parameter handle is 1-based parameter index, same order as getParamInfoList
+static int checkParamHandle(lua_State *L, Live2LOVE *l2l, int idx)
+{
+	lua_Integer handle = luaL_checkinteger(L, idx);
+	if (handle <= 0 || handle > l2l->model->GetParameterCount())
+		luaL_argerror(L, idx, "invalid parameter handle");
+
+	return (int) handle - 1;
+}
+
+int Live2LOVE_getParamHandle(lua_State *L)
+{
+	// Get udata
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	// Get param name
+	size_t nameLen; const char *name = luaL_checklstring(L, 2, &nameLen);
+	// Resolve
+	int index = l2l->getParamIndex(std::string(name, nameLen));
+
+	if (index == -1)
+		lua_pushnil(L);
+	else
+		lua_pushinteger(L, index + 1);
+
+	return 1;
+}
+
+int Live2LOVE_setParamValueByHandle(lua_State *L)
+{
+	// Get udata
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	// Get param handle
+	int index = checkParamHandle(L, l2l, 2);
+	// Get value
+	double value = luaL_checknumber(L, 3);
+	// Get weight
+	double weight = luaL_optnumber(L, 4, 1.0);
+	// Call
+	L2L_TRYWRAP(l2l->setParamValue(index, value, weight););
+
+	return 0;
+}
+
+// Copypaste from Live2LOVE_setParamValueByHandle
+int Live2LOVE_setParamValuePostByHandle(lua_State *L)
+{
+	// Get udata
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	// Get param handle
+	int index = checkParamHandle(L, l2l, 2);
+	// Get value
+	double value = luaL_checknumber(L, 3);
+	// Get weight
+	double weight = luaL_optnumber(L, 4, 1.0);
+	// Call
+	L2L_TRYWRAP(l2l->setParamValuePost(index, value, weight););
+
+	return 0;
+}
+
+// Copypaste from Live2LOVE_setParamValueByHandle
+int Live2LOVE_addParamValueByHandle(lua_State *L)
+{
+	// Get udata
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	// Get param handle
+	int index = checkParamHandle(L, l2l, 2);
+	// Get value
+	double value = luaL_checknumber(L, 3);
+	// Get weight
+	double weight = luaL_optnumber(L, 4, 1.0);
+	// Call
+	L2L_TRYWRAP(l2l->addParamValue(index, value, weight););
+
+	return 0;
+}
+
+// Copypaste from Live2LOVE_setParamValueByHandle
+int Live2LOVE_mulParamValueByHandle(lua_State *L)
+{
+	// Get udata
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	// Get param handle
+	int index = checkParamHandle(L, l2l, 2);
+	// Get value
+	double value = luaL_checknumber(L, 3);
+	// Get weight
+	double weight = luaL_optnumber(L, 4, 1.0);
+	// Call
+	L2L_TRYWRAP(l2l->mulParamValue(index, value, weight););
+
+	return 0;
+}
+
+int Live2LOVE_getParamValueByHandle(lua_State *L)
+{
+	// Get udata
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	// Get param handle
+	int index = checkParamHandle(L, l2l, 2);
+	double value;
+	// Call
+	L2L_TRYWRAP(value = l2l->getParamValue(index););
+
+	// Push value
+	lua_pushnumber(L, value);
+	return 1;
+}
+
+typedef void (Live2LOVE::*ParamNameFunc)(const std::string&, double, double);
+
+// Element i of table idx as number. If optional is true, nil gives def.
+static double checkTableNumber(lua_State *L, int idx, int i, bool optional = false, double def = 0)
+{
+	lua_rawgeti(L, idx, i);
+	double value = def;
+
+	if (lua_type(L, -1) == LUA_TNUMBER)
+		value = lua_tonumber(L, -1);
+	else if (!optional || !lua_isnil(L, -1))
+		luaL_error(L, "bad value at index %d (number expected, got %s)", i, luaL_typename(L, -1));
+
+	lua_pop(L, 1);
+	return value;
+}
+
+// setParams(namesOrHandles, values[, weights]) and its variants
+template<ParamOpID op, ParamNameFunc byName> int Live2LOVE_setParamsCommon(lua_State *L)
+{
+	// Get udata
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	// Get tables
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	bool hasWeights = !lua_isnoneornil(L, 4);
+	if (hasWeights)
+		luaL_checktype(L, 4, LUA_TTABLE);
+
+	int count = (int) lua_objlen(L, 2);
+	int paramCount = l2l->model->GetParameterCount();
+	std::vector<Live2LOVEPostParam> params;
+	// Table positions of names which the model doesn't have
+	std::vector<int> unknownNames;
+	params.reserve(count);
+
+	// Check everything before touching the model
+	for (int i = 1; i <= count; i++)
+	{
+		double value = checkTableNumber(L, 3, i);
+		double weight = hasWeights ? checkTableNumber(L, 4, i, true, 1.0) : 1.0;
+
+		lua_rawgeti(L, 2, i);
+		int type = lua_type(L, -1);
+		int index = -1;
+
+		if (type == LUA_TNUMBER)
+		{
+			lua_Integer handle = lua_tointeger(L, -1);
+			if (handle <= 0 || handle > paramCount)
+				luaL_error(L, "invalid parameter handle at index %d", i);
+
+			index = (int) handle - 1;
+		}
+		else if (type == LUA_TSTRING)
+		{
+			index = l2l->getParamIndex(lua_tostring(L, -1));
+			if (index == -1)
+				unknownNames.push_back(i);
+		}
+		else
+			luaL_error(L, "bad parameter at index %d (string or number expected, got %s)", i, luaL_typename(L, -1));
+
+		if (index != -1)
+			params.push_back({index, (float) value, (float) weight});
+
+		lua_pop(L, 1);
+	}
+
+	L2L_TRYWRAP(
+		l2l->applyParams(op, params);
+
+		// Rare, go through the Framework by name
+		for (int i: unknownNames)
+		{
+			double value = checkTableNumber(L, 3, i);
+			double weight = hasWeights ? checkTableNumber(L, 4, i, true, 1.0) : 1.0;
+			size_t nameLen;
+			lua_rawgeti(L, 2, i);
+			const char *name = lua_tolstring(L, -1, &nameLen);
+			(l2l->*byName)(std::string(name, nameLen), value, weight);
+			lua_pop(L, 1);
+		}
+	);
+
+	return 0;
+}
+
+int Live2LOVE_getParams(lua_State *L)
+{
+	// Get udata
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	// Get parameter list
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int count = (int) lua_objlen(L, 2);
+	int paramCount = l2l->model->GetParameterCount();
+
+	// Get or create output table
+	if (lua_isnoneornil(L, 3))
+	{
+		lua_settop(L, 2);
+		lua_createtable(L, count, 0);
+	}
+	else
+	{
+		luaL_checktype(L, 3, LUA_TTABLE);
+		lua_settop(L, 3);
+	}
+
+	L2L_TRYWRAP(l2l->waitSimulation(););
+
+	for (int i = 1; i <= count; i++)
+	{
+		double value;
+		lua_rawgeti(L, 2, i);
+		int type = lua_type(L, -1);
+
+		if (type == LUA_TNUMBER)
+		{
+			lua_Integer handle = lua_tointeger(L, -1);
+			if (handle <= 0 || handle > paramCount)
+				luaL_error(L, "invalid parameter handle at index %d", i);
+
+			value = l2l->model->GetParameterValue((int) handle - 1);
+		}
+		else if (type == LUA_TSTRING)
+		{
+			size_t nameLen; const char *name = lua_tolstring(L, -1, &nameLen);
+			int index = l2l->getParamIndex(name);
+
+			if (index != -1)
+				value = l2l->model->GetParameterValue(index);
+			else
+				// Rare, go through the Framework by name
+				L2L_TRYWRAP(value = l2l->getParamValue(std::string(name, nameLen)););
+		}
+		else
+			luaL_error(L, "bad parameter at index %d (string or number expected, got %s)", i, luaL_typename(L, -1));
+
+		lua_pop(L, 1);
+		lua_pushnumber(L, value);
+		lua_rawseti(L, 3, i);
+	}
+
+	return 1;
+}
+
+// Push pointer as LuaJIT FFI cdata of specified type
+static void pushFFIPointer(lua_State *L, const void *ptr, const char *ctype)
+{
+	RefData::getRef(L, RefData::LIVE2LOVE_FFICAST);
+
+	if (lua_isnil(L, -1))
+	{
+		lua_pop(L, 1);
+
+		// Pointer is passed as string to avoid lightuserdata restrictions
+		if (luaL_loadstring(L, R"Live2LOVE(
+local ffi = require("ffi")
+return function(ptr, ctype)
+	return ffi.cast(ctype, ffi.cast("void**", ffi.cast("const char*", ptr))[0])
+end
+		)Live2LOVE") != 0 || lua_pcall(L, 0, 1, 0) != 0)
+			luaL_error(L, "LuaJIT FFI is not available: %s", lua_tostring(L, -1));
+
+		RefData::setRef(L, RefData::LIVE2LOVE_FFICAST, -1);
+	}
+
+	lua_pushlstring(L, (const char *) &ptr, sizeof(void*));
+	lua_pushstring(L, ctype);
+	lua_call(L, 2, 1);
+}
+
+// Set field of table at -1 to FFI pointer
+static void setFFIPointerField(lua_State *L, const char *name, const void *ptr, const char *ctype)
+{
+	lua_pushstring(L, name);
+	pushFFIPointer(L, ptr, ctype);
+	lua_rawset(L, -3);
+}
+
+// Set field of table at -1 to table of name to 0-based index
+static void setIndexMapField(lua_State *L, const char *name, const char **ids, int count)
+{
+	lua_pushstring(L, name);
+	lua_createtable(L, 0, count);
+
+	for (int i = 0; i < count; i++)
+	{
+		lua_pushstring(L, ids[i]);
+		lua_pushinteger(L, i);
+		lua_rawset(L, -3);
+	}
+
+	lua_rawset(L, -3);
+}
+
+int Live2LOVE_getFFIData(lua_State *L)
+{
+	// Get udata
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	L2L_TRYWRAP(l2l->waitSimulation(););
+	Live2D::Cubism::Core::csmModel *mdl = l2l->model->GetModel();
+	int paramCount = Live2D::Cubism::Core::csmGetParameterCount(mdl);
+	int partCount = Live2D::Cubism::Core::csmGetPartCount(mdl);
+
+	lua_createtable(L, 0, 10);
+	lua_pushstring(L, "parameterCount");
+	lua_pushinteger(L, paramCount);
+	lua_rawset(L, -3);
+	setFFIPointerField(L, "parameterValues", Live2D::Cubism::Core::csmGetParameterValues(mdl), "float*");
+	setFFIPointerField(L, "parameterMinimumValues", Live2D::Cubism::Core::csmGetParameterMinimumValues(mdl), "const float*");
+	setFFIPointerField(L, "parameterMaximumValues", Live2D::Cubism::Core::csmGetParameterMaximumValues(mdl), "const float*");
+	setFFIPointerField(L, "parameterDefaultValues", Live2D::Cubism::Core::csmGetParameterDefaultValues(mdl), "const float*");
+	setIndexMapField(L, "parameterIndex", Live2D::Cubism::Core::csmGetParameterIds(mdl), paramCount);
+	lua_pushstring(L, "partCount");
+	lua_pushinteger(L, partCount);
+	lua_rawset(L, -3);
+	setFFIPointerField(L, "partOpacities", Live2D::Cubism::Core::csmGetPartOpacities(mdl), "float*");
+	setIndexMapField(L, "partIndex", Live2D::Cubism::Core::csmGetPartIds(mdl), partCount);
+
+	return 1;
+}
+
 int Live2LOVE_getParamInfoList(lua_State *L)
 {
 	// Get udata
@@ -390,7 +731,106 @@ int Live2LOVE_setAnimationMovement(lua_State *L)
 {
 	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
 	luaL_checktype(L, 2, LUA_TBOOLEAN);
-	l2l->setAnimationMovement(lua_toboolean(L, 2) != 0);
+	L2L_TRYWRAP(l2l->setAnimationMovement(lua_toboolean(L, 2) != 0););
+	return 0;
+}
+
+int Live2LOVE_setPipelined(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	luaL_checktype(L, 2, LUA_TBOOLEAN);
+	L2L_TRYWRAP(l2l->setPipelined(lua_toboolean(L, 2) != 0););
+	return 0;
+}
+
+int Live2LOVE_setSimulationRate(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	double rate = luaL_checknumber(L, 2);
+	int substeps = (int) luaL_optinteger(L, 3, 4);
+	L2L_TRYWRAP(l2l->setSimulationRate(rate, substeps););
+	return 0;
+}
+
+int Live2LOVE_setUpdateInterval(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+
+	if (lua_type(L, 2) == LUA_TSTRING)
+	{
+		const char *mode = lua_tostring(L, 2);
+		if (strcmp(mode, "auto") != 0)
+			luaL_argerror(L, 2, "number or \"auto\" expected");
+
+		double fullScale = luaL_optnumber(L, 3, 1);
+		int maxInterval = (int) luaL_optinteger(L, 4, 4);
+		L2L_TRYWRAP(l2l->setAutoUpdateInterval(fullScale, maxInterval););
+	}
+	else
+	{
+		int interval = (int) luaL_checkinteger(L, 2);
+		L2L_TRYWRAP(l2l->setUpdateInterval(interval););
+	}
+
+	return 0;
+}
+
+int Live2LOVE_setCullRect(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+
+	if (lua_isnoneornil(L, 2))
+		l2l->setCullRect();
+	else
+	{
+		double x = luaL_checknumber(L, 2);
+		double y = luaL_checknumber(L, 3);
+		double w = luaL_checknumber(L, 4);
+		double h = luaL_checknumber(L, 5);
+		l2l->setCullRect(x, y, w, h);
+	}
+
+	return 0;
+}
+
+int Live2LOVE_setBatching(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	luaL_checktype(L, 2, LUA_TBOOLEAN);
+	L2L_TRYWRAP(l2l->setBatching(lua_toboolean(L, 2) != 0););
+	return 0;
+}
+
+int Live2LOVE_setRenderCache(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	luaL_checktype(L, 2, LUA_TBOOLEAN);
+	L2L_TRYWRAP(l2l->setRenderCache(lua_toboolean(L, 2) != 0););
+	return 0;
+}
+
+static std::vector<std::string> clipStringMode = {"stencil", "canvas"};
+
+int Live2LOVE_setClippingMode(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	std::string modeStr = std::string(luaL_checkstring(L, 2));
+	int size = (int) luaL_optinteger(L, 3, 512);
+	ClipModeID mode = CLIP_MAX_ENUM;
+
+	for (int i = 0; i < CLIP_MAX_ENUM; i++)
+	{
+		if (clipStringMode[i] == modeStr)
+		{
+			mode = (ClipModeID) i;
+			break;
+		}
+	}
+
+	if (mode == CLIP_MAX_ENUM)
+		luaL_argerror(L, 2, "invalid clipping mode");
+
+	L2L_TRYWRAP(l2l->setClippingMode(mode, size););
 	return 0;
 }
 
@@ -398,7 +838,7 @@ int Live2LOVE_setEyeBlinkMovement(lua_State *L)
 {
 	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
 	luaL_checktype(L, 2, LUA_TBOOLEAN);
-	l2l->setEyeBlinkMovement(lua_toboolean(L, 2) != 0);
+	L2L_TRYWRAP(l2l->setEyeBlinkMovement(lua_toboolean(L, 2) != 0););
 	return 0;
 }
 
@@ -463,6 +903,20 @@ int Live2LOVE_loadPhysics(lua_State *L)
 	return 0;
 }
 
+int Live2LOVE_clone(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	Live2LOVE *clone = nullptr;
+	L2L_TRYWRAP(clone = l2l->clone(););
+	// Create new user data
+	Live2LOVE **obj = (Live2LOVE**)lua_newuserdata(L, sizeof(Live2LOVE*));
+	*obj = clone;
+	// Set userdata metatable
+	luaL_getmetatable(L, "Live2LOVE");
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
 int Live2LOVE_update(lua_State *L)
 {
 	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
@@ -471,6 +925,69 @@ int Live2LOVE_update(lua_State *L)
 	return 0;
 }
 
+// Update deformation twice per step like older versions. For bench/update.
+int Live2LOVE__setDoubleUpdate(lua_State *L)
+{
+	Live2LOVE::doubleUpdate = lua_toboolean(L, 1) != 0;
+	return 0;
+}
+
+// Update multiple models. Simulation runs in worker threads.
+int Live2LOVE_updateAll(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	double dT = luaL_checknumber(L, 2);
+	int count = (int) lua_objlen(L, 1);
+	std::vector<Live2LOVE*> models;
+	models.reserve(count);
+
+	// Get models
+	luaL_getmetatable(L, "Live2LOVE");
+	for (int i = 1; i <= count; i++)
+	{
+		lua_rawgeti(L, 1, i);
+		if (lua_type(L, -1) != LUA_TUSERDATA || lua_getmetatable(L, -1) == 0 || lua_rawequal(L, -1, -3) == 0)
+			luaL_error(L, "bad model at index %d (Live2LOVE expected)", i);
+
+		models.push_back(*(Live2LOVE**)lua_touserdata(L, -2));
+		lua_pop(L, 2);
+	}
+	lua_pop(L, 1);
+
+	// Same model must not be simulated by 2 threads at once
+	std::sort(models.begin(), models.end());
+	models.erase(std::unique(models.begin(), models.end()), models.end());
+
+	// Finish pending background simulation of pipelined models
+	for (Live2LOVE *l2l: models)
+		L2L_TRYWRAP(l2l->waitSimulation(););
+
+	// Simulate
+	std::mutex errorMutex;
+	std::string error;
+	ThreadPool::getInstance()->parallelFor((int) models.size(), [&](int i)
+	{
+		try
+		{
+			models[i]->simulate(dT);
+		}
+		catch (std::exception &x)
+		{
+			std::lock_guard<std::mutex> lock(errorMutex);
+			error = x.what();
+		}
+	});
+
+	if (!error.empty())
+		luaL_error(L, "%s", error.c_str());
+
+	// Upload vertices
+	for (Live2LOVE *l2l: models)
+		L2L_TRYWRAP(l2l->upload(););
+
+	return 0;
+}
+
 int Live2LOVE_draw(lua_State *L)
 {
 	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
@@ -487,6 +1004,66 @@ int Live2LOVE_draw(lua_State *L)
 	return 0;
 }
 
+int Live2LOVE_drawInstanced(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int count = (int) lua_objlen(L, 2);
+	std::vector<Live2LOVE::DrawInstance> instances(count);
+	// x, y, r, sx, sy, ox, oy, kx, ky
+	static const double defaults[9] = {0, 0, 0, 1, 1, 0, 0, 0, 0};
+
+	for (int i = 0; i < count; i++)
+	{
+		Live2LOVE::DrawInstance &instance = instances[i];
+		double coords[9];
+
+		lua_rawgeti(L, 2, i + 1);
+		if (!lua_istable(L, -1))
+			luaL_error(L, "bad instance at index %d (table expected)", i + 1);
+
+		for (int j = 0; j < 9; j++)
+		{
+			lua_rawgeti(L, -1, j + 1);
+			if (lua_isnil(L, -1))
+				coords[j] = defaults[j];
+			else if (lua_isnumber(L, -1))
+				coords[j] = lua_tonumber(L, -1);
+			else
+				luaL_error(L, "bad instance at index %d (number expected at index %d)", i + 1, j + 1);
+			lua_pop(L, 1);
+		}
+
+		instance.coords = Live2LOVE::DrawCoordinates {
+			coords[0], coords[1], coords[2],
+			coords[3], coords[4],
+			coords[5], coords[6],
+			coords[7], coords[8]
+		};
+
+		// Optional tint color
+		lua_getfield(L, -1, "color");
+		bool hasColor = lua_istable(L, -1);
+		for (int j = 0; j < 4; j++)
+		{
+			instance.color[j] = 1.0f;
+
+			if (hasColor)
+			{
+				lua_rawgeti(L, -1, j + 1);
+				if (lua_isnumber(L, -1))
+					instance.color[j] = (float) lua_tonumber(L, -1);
+				lua_pop(L, 1);
+			}
+		}
+
+		lua_pop(L, 2);
+	}
+
+	L2L_TRYWRAP(l2l->drawInstanced(instances););
+	return 0;
+}
+
 int Live2LOVE_getMeshCount(lua_State *L)
 {
 	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
@@ -498,6 +1075,8 @@ int Live2LOVE_getMesh(lua_State *L)
 {
 	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
 	size_t meshLen = l2l->meshData.size();
+	if (l2l->meshMode == MESH_SHARED)
+		luaL_error(L, "Mesh objects are not available in shared mesh mode");
 	if (lua_isnumber(L, 2))
 	{
 		// Individual mesh
@@ -521,6 +1100,25 @@ int Live2LOVE_getMesh(lua_State *L)
 	return 1;
 }
 
+int Live2LOVE_getStats(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	const Live2LOVEStats &stats = l2l->stats;
+
+	lua_createtable(L, 0, 3);
+	lua_pushstring(L, "uploadedDrawables");
+	lua_pushinteger(L, stats.uploadedDrawables);
+	lua_rawset(L, -3);
+	lua_pushstring(L, "hiddenDrawables");
+	lua_pushinteger(L, stats.hiddenDrawables);
+	lua_rawset(L, -3);
+	lua_pushstring(L, "drawCalls");
+	lua_pushinteger(L, stats.drawCalls);
+	lua_rawset(L, -3);
+
+	return 1;
+}
+
 int Live2LOVE_getDimensions(lua_State *L)
 {
 	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
@@ -572,6 +1170,74 @@ int Live2LOVE_getMotionList(lua_State *L)
 	return 1;
 }
 
+int Live2LOVE_isPipelined(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	lua_pushboolean(L, l2l->isPipelined());
+	return 1;
+}
+
+int Live2LOVE_getSimulationRate(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	std::pair<double, int> rate = l2l->getSimulationRate();
+	lua_pushnumber(L, rate.first);
+	lua_pushinteger(L, rate.second);
+	return 2;
+}
+
+int Live2LOVE_getUpdateInterval(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	lua_pushinteger(L, l2l->getUpdateInterval());
+	return 1;
+}
+
+int Live2LOVE_getBounds(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	std::pair<float, float> min = l2l->getBoundsMin();
+	std::pair<float, float> max = l2l->getBoundsMax();
+
+	if (min.first > max.first || min.second > max.second)
+		return 0;
+
+	lua_pushnumber(L, min.first);
+	lua_pushnumber(L, min.second);
+	lua_pushnumber(L, max.first - min.first);
+	lua_pushnumber(L, max.second - min.second);
+	return 4;
+}
+
+int Live2LOVE_isBatching(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	lua_pushboolean(L, l2l->isBatching());
+	return 1;
+}
+
+int Live2LOVE_isRenderCache(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	lua_pushboolean(L, l2l->isRenderCache());
+	return 1;
+}
+
+int Live2LOVE_getClippingMode(lua_State *L)
+{
+	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
+	std::pair<ClipModeID, int> mode = l2l->getClippingMode();
+	lua_pushstring(L, clipStringMode[mode.first].c_str());
+
+	if (mode.first == CLIP_CANVAS)
+	{
+		lua_pushinteger(L, mode.second);
+		return 2;
+	}
+
+	return 1;
+}
+
 int Live2LOVE_isAnimationMovementEnabled(lua_State *L)
 {
 	Live2LOVE *l2l = *(Live2LOVE**)luaL_checkudata(L, 1, "Live2LOVE");
@@ -609,10 +1275,10 @@ int Live2LOVE_loadEyeBlink(lua_State *L)
 		}
 
 		if (eyeBlinks.size() > 0)
-			l2l->loadEyeBlink(eyeBlinks);
+			L2L_TRYWRAP(l2l->loadEyeBlink(eyeBlinks););
 	}
 	else
-		l2l->loadEyeBlink();
+		L2L_TRYWRAP(l2l->loadEyeBlink(););
 
 	return 0;
 }
@@ -658,6 +1324,13 @@ int Live2LOVE___tostring(lua_State *L)
 static luaL_Reg Live2LOVE_methods[] = {
 	{"setTexture", Live2LOVE_setTexture},
 	{"setAnimationMovement", Live2LOVE_setAnimationMovement},
+	{"setPipelined", Live2LOVE_setPipelined},
+	{"setSimulationRate", Live2LOVE_setSimulationRate},
+	{"setUpdateInterval", Live2LOVE_setUpdateInterval},
+	{"setCullRect", Live2LOVE_setCullRect},
+	{"setBatching", Live2LOVE_setBatching},
+	{"setRenderCache", Live2LOVE_setRenderCache},
+	{"setClippingMode", Live2LOVE_setClippingMode},
 	{"setEyeBlinkMovement", Live2LOVE_setEyeBlinkMovement},
 	{"setParamValue", Live2LOVE_setParamValue},
 	{"setParamValuePost", Live2LOVE_setParamValuePost},
@@ -671,6 +1344,18 @@ static luaL_Reg Live2LOVE_methods[] = {
 	{"loadPose", Live2LOVE_loadPose},
 	{"initializeEyeBlink", Live2LOVE_loadEyeBlink},
 	{"getParamValue", Live2LOVE_getParamValue},
+	{"getParamHandle", Live2LOVE_getParamHandle},
+	{"setParamValueByHandle", Live2LOVE_setParamValueByHandle},
+	{"setParamValuePostByHandle", Live2LOVE_setParamValuePostByHandle},
+	{"addParamValueByHandle", Live2LOVE_addParamValueByHandle},
+	{"mulParamValueByHandle", Live2LOVE_mulParamValueByHandle},
+	{"getParamValueByHandle", Live2LOVE_getParamValueByHandle},
+	{"setParams", Live2LOVE_setParamsCommon<PARAM_SET, &Live2LOVE::setParamValue>},
+	{"setParamsPost", Live2LOVE_setParamsCommon<PARAM_SET_POST, &Live2LOVE::setParamValuePost>},
+	{"addParams", Live2LOVE_setParamsCommon<PARAM_ADD, &Live2LOVE::addParamValue>},
+	{"mulParams", Live2LOVE_setParamsCommon<PARAM_MUL, &Live2LOVE::mulParamValue>},
+	{"getParams", Live2LOVE_getParams},
+	{"getFFIData", Live2LOVE_getFFIData},
 	{"getParamInfoList", Live2LOVE_getParamInfoList},
 	{"getMesh", Live2LOVE_getMesh},
 	{"getMeshCount", Live2LOVE_getMeshCount},
@@ -680,21 +1365,68 @@ static luaL_Reg Live2LOVE_methods[] = {
 	{"getWidth", Live2LOVE_getWidth},
 	{"getHeight", Live2LOVE_getHeight},
 	{"getDimensions", Live2LOVE_getDimensions},
+	{"getStats", Live2LOVE_getStats},
 	{"isAnimationMovementEnabled", Live2LOVE_isAnimationMovementEnabled},
+	{"isPipelined", Live2LOVE_isPipelined},
+	{"getSimulationRate", Live2LOVE_getSimulationRate},
+	{"getUpdateInterval", Live2LOVE_getUpdateInterval},
+	{"getBounds", Live2LOVE_getBounds},
+	{"isBatching", Live2LOVE_isBatching},
+	{"isRenderCache", Live2LOVE_isRenderCache},
+	{"getClippingMode", Live2LOVE_getClippingMode},
 	{"isEyeBlinkEnabled", Live2LOVE_isEyeBlinkEnabled},
+	{"clone", Live2LOVE_clone},
 	{"update", Live2LOVE_update},
-	{"draw", Live2LOVE_draw}
+	{"draw", Live2LOVE_draw},
+	{"drawInstanced", Live2LOVE_drawInstanced}
 };
 
+static std::vector<std::string> meshStringMode = {"separate", "shared"};
+
+// Get "meshMode" field of model settings table
+static MeshModeID getMeshModeSetting(lua_State *L, int idx)
+{
+	MeshModeID mode = MESH_SEPARATE;
+
+	if (lua_istable(L, idx))
+	{
+		lua_getfield(L, idx, "meshMode");
+
+		if (!lua_isnil(L, -1))
+		{
+			std::string modeStr = std::string(luaL_checkstring(L, -1));
+			mode = MESH_MAX_ENUM;
+
+			for (int i = 0; i < MESH_MAX_ENUM; i++)
+			{
+				if (meshStringMode[i] == modeStr)
+				{
+					mode = (MeshModeID) i;
+					break;
+				}
+			}
+
+			if (mode == MESH_MAX_ENUM)
+				luaL_error(L, "invalid mesh mode \"%s\"", modeStr.c_str());
+		}
+
+		lua_pop(L, 1);
+	}
+
+	return mode;
+}
+
 // Load model file (basic)
 int Live2LOVE_Live2LOVE(lua_State *L)
 {
 	size_t mocSize;
 	Live2LOVE *l2l = nullptr;
+	// Get settings
+	MeshModeID meshMode = getMeshModeSetting(L, 2);
 	// Get path
 	const void *mocBuf = argToData(L, 1, mocSize);
 	// Call constructor
-	L2L_TRYWRAP(l2l = new Live2LOVE(L, mocBuf, mocSize););
+	L2L_TRYWRAP(l2l = new Live2LOVE(L, mocBuf, mocSize, meshMode););
 	// Create new user data
 	Live2LOVE **obj = (Live2LOVE**)lua_newuserdata(L, sizeof(Live2LOVE*));
 	*obj = l2l;
@@ -708,7 +1440,7 @@ int Live2LOVE_Live2LOVE(lua_State *L)
 const void *loadFileData(lua_State *L, const std::string& path, size_t &fileSize)
 {
 	// New file data
-	RefData::getRef(L, "love.filesystem.newFileData");
+	RefData::getRef(L, RefData::LOVE_FILESYSTEM_NEWFILEDATA);
 	lua_pushlstring(L, path.c_str(), path.length());
 	lua_call(L, 1, 2);
 	if (lua_isnil(L, -2))
@@ -727,6 +1459,7 @@ int Live2LOVE_Live2LOVE_full(lua_State *L)
 	size_t fileLen, dataSize;
 	const char *file = luaL_checklstring(L, 1, &fileLen);
 	std::string filename = std::string(file, fileLen);
+	MeshModeID meshMode = getMeshModeSetting(L, 3);
 	const char *data;
 	L2L_TRYWRAP(data = (const char *) loadFileData(L, filename, dataSize););
 
@@ -785,7 +1518,7 @@ int Live2LOVE_Live2LOVE_full(lua_State *L)
 	Live2LOVE *l2l = nullptr;
 	size_t modelSize;
 	const void *modelData = loadFileData(L, dir + mocStr.get<std::string>(), modelSize);
-	L2L_TRYWRAP(l2l = new Live2LOVE(L, modelData, modelSize););
+	L2L_TRYWRAP(l2l = new Live2LOVE(L, modelData, modelSize, meshMode););
 
 	// Textures
 	if (fileRef.count("Textures") > 0)
@@ -809,7 +1542,7 @@ int Live2LOVE_Live2LOVE_full(lua_State *L)
 			lua_pushvalue(L, 2);
 
 		// New image function
-		RefData::getRef(L, "love.graphics.newImage");
+		RefData::getRef(L, RefData::LOVE_GRAPHICS_NEWIMAGE);
 		// Loop
 		auto &tex = textures.get<picojson::array>();
 		for (int i = 0; i < tex.size(); i++)
@@ -1054,6 +1787,13 @@ int Live2LOVE_Live2LOVE_full(lua_State *L)
 #define EXPORT_SIGNATURE
 #endif
 
+// Destroy worker threads when Lua state is closed, before the module is unloaded
+int Live2LOVE_threadPoolSentinel___gc(lua_State *L)
+{
+	ThreadPool::destroyInstance();
+	return 0;
+}
+
 extern "C" int EXPORT_SIGNATURE luaopen_Live2LOVE(lua_State *L)
 {
 	// Initialize Live2D
@@ -1067,8 +1807,16 @@ extern "C" int EXPORT_SIGNATURE luaopen_Live2LOVE(lua_State *L)
 	if (Live2D::Cubism::Framework::CubismFramework::IsInitialized() == false)
 		Live2D::Cubism::Framework::CubismFramework::Initialize();
 
+	// Motions register these IDs on first update. Register them now, as the ID
+	// manager isn't thread-safe and updateAll updates models in worker threads.
+	Live2D::Cubism::Framework::CubismFramework::GetIdManager()->GetId("EyeBlink");
+	Live2D::Cubism::Framework::CubismFramework::GetIdManager()->GetId("LipSync");
+	Live2D::Cubism::Framework::CubismFramework::GetIdManager()->GetId("Opacity");
+
 	// Create new Live2LOVE metatable
 	luaL_newmetatable(L, "Live2LOVE");
+	// References are stored in the metatable
+	RefData::setMainTable(L, -1);
 	// Setup function methods
 	lua_pushstring(L, "__gc");
 	lua_pushcfunction(L, Live2LOVE___gc);
@@ -1088,6 +1836,16 @@ extern "C" int EXPORT_SIGNATURE luaopen_Live2LOVE(lua_State *L)
 	lua_rawset(L, -3); // For the Live2LOVE metatable. set __index to table
 	lua_pop(L, 1); // Remove the metatable from stack for now.
 
+	// Thread pool sentinel
+	lua_newuserdata(L, 1);
+	lua_createtable(L, 0, 1);
+	lua_pushstring(L, "__gc");
+	lua_pushcfunction(L, Live2LOVE_threadPoolSentinel___gc);
+	lua_rawset(L, -3);
+	lua_setmetatable(L, -2);
+	RefData::setRef(L, RefData::LIVE2LOVE_THREADPOOLSENTINEL, -1);
+	lua_pop(L, 1);
+
 	// Setup needed LOVE functions
 	lua_getfield(L, LUA_GLOBALSINDEX, "package");
 	lua_getfield(L, -1, "loaded");
@@ -1112,61 +1870,88 @@ extern "C" int EXPORT_SIGNATURE luaopen_Live2LOVE(lua_State *L)
 	
 	// Get needed function
 	lua_getfield(L, -1, "clear");
-	RefData::setRef(L, "love.graphics.clear", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_CLEAR, -1);
 	lua_pop(L, 1); // pop the function
 	lua_getfield(L, -1, "draw");
-	RefData::setRef(L, "love.graphics.draw", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_DRAW, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "drawInstanced");
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_DRAWINSTANCED, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "newCanvas");
-	RefData::setRef(L, "love.graphics.newCanvas", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_NEWCANVAS, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "newMesh");
-	RefData::setRef(L, "love.graphics.newMesh", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_NEWMESH, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "setBlendMode");
-	RefData::setRef(L, "love.graphics.setBlendMode", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_SETBLENDMODE, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "getBlendMode");
-	RefData::setRef(L, "love.graphics.getBlendMode", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_GETBLENDMODE, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "newImage");
-	RefData::setRef(L, "love.graphics.newImage", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_NEWIMAGE, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "reset");
-	RefData::setRef(L, "love.graphics.reset", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_RESET, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "setStencilTest");
-	RefData::setRef(L, "love.graphics.setStencilTest", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_SETSTENCILTEST, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "stencil");
-	RefData::setRef(L, "love.graphics.stencil", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_STENCIL, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "newShader");
-	RefData::setRef(L, "love.graphics.newShader", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_NEWSHADER, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "pop");
-	RefData::setRef(L, "love.graphics.pop", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_POP, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "push");
-	RefData::setRef(L, "love.graphics.push", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_PUSH, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "setCanvas");
-	RefData::setRef(L, "love.graphics.setCanvas", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_SETCANVAS, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "setShader");
-	RefData::setRef(L, "love.graphics.setShader", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_SETSHADER, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "getShader");
-	RefData::setRef(L, "love.graphics.getShader", -1);
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_GETSHADER, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "transformPoint");
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_TRANSFORMPOINT, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "origin");
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_ORIGIN, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "getColor");
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_GETCOLOR, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "setColor");
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_SETCOLOR, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "setColorMask");
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_SETCOLORMASK, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "setScissor");
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_SETSCISSOR, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "getScissor");
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_GETSCISSOR, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "intersectScissor");
+	RefData::setRef(L, RefData::LOVE_GRAPHICS_INTERSECTSCISSOR, -1);
 	lua_pop(L, 2); // pop the function and the graphics table
 
 	// Setup newFileData
 	lua_getfield(L, -1, "filesystem"); // assume it's always available
 	lua_getfield(L, -1, "newFileData");
-	RefData::setRef(L, "love.filesystem.newFileData", -1);
+	RefData::setRef(L, RefData::LOVE_FILESYSTEM_NEWFILEDATA, -1);
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "read");
-	RefData::setRef(L, "love.filesystem.read", -1);
+	RefData::setRef(L, RefData::LOVE_FILESYSTEM_READ, -1);
 	lua_pop(L, 2); // pop the function and "filesystem" table.
 
 	// Setup newByteData
@@ -1180,8 +1965,11 @@ extern "C" int EXPORT_SIGNATURE luaopen_Live2LOVE(lua_State *L)
 		lua_call(L, 1, 1);
 	}
 	lua_getfield(L, -1, "newByteData");
-	RefData::setRef(L, "love.data.newByteData", -1);
-	lua_pop(L, 3); // pop newByteData, love.data, and love table itself
+	RefData::setRef(L, RefData::LOVE_DATA_NEWBYTEDATA, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "newDataView");
+	RefData::setRef(L, RefData::LOVE_DATA_NEWDATAVIEW, -1);
+	lua_pop(L, 3); // pop newDataView, love.data, and love table itself
 
 	// Export table
 	lua_createtable(L, 0, 0);
@@ -1191,6 +1979,12 @@ extern "C" int EXPORT_SIGNATURE luaopen_Live2LOVE(lua_State *L)
 	lua_pushstring(L, "loadModel");
 	lua_pushcfunction(L, Live2LOVE_Live2LOVE_full);
 	lua_rawset(L, -3);
+	lua_pushstring(L, "updateAll");
+	lua_pushcfunction(L, Live2LOVE_updateAll);
+	lua_rawset(L, -3);
+	lua_pushstring(L, "_setDoubleUpdate");
+	lua_pushcfunction(L, Live2LOVE__setDoubleUpdate);
+	lua_rawset(L, -3);
 	lua_pushstring(L, "_VERSION");
 	lua_pushstring(L, "0.6.0");
 	lua_rawset(L, -3);
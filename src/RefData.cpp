@@ -18,10 +18,6 @@
  * 3. This notice may not be removed or altered from any source distribution.
  **/
 
-// STL
-#include <map>
-#include <string>
-
 // Lua
 extern "C" {
 #include <lua.h>
@@ -31,7 +27,10 @@ extern "C" {
 // RefData
 #include "RefData.h"
 
-static std::map<std::string, int> namedRef;
+// Registry slot of Live2LOVE main table
+static int mainTableRef = LUA_NOREF;
+// Reference IDs of named references
+static int namedRef[RefData::NAMED_REF_MAX_ENUM] = {};
 
 // Helper to convert index
 inline int toPositiveIndex(lua_State *L, int idx)
@@ -39,54 +38,62 @@ inline int toPositiveIndex(lua_State *L, int idx)
 	return idx < 0 ? lua_gettop(L) + (idx + 1) : idx;
 }
 
+void RefData::setMainTable(lua_State *L, int idx)
+{
+	// The library stays loaded when LOVE restarts with a new lua_State, so
+	// references of the previous state must be forgotten, not released.
+	for (int i = 0; i < NAMED_REF_MAX_ENUM; i++)
+		namedRef[i] = LUA_NOREF;
+
+	lua_pushvalue(L, idx);
+	mainTableRef = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
 void RefData::getRef(lua_State *L, int refID)
 {
-	lua_pushstring(L, "Live2LOVE");
-	lua_rawget(L, LUA_REGISTRYINDEX);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, mainTableRef);
 	lua_rawgeti(L, -1, refID);
 	lua_remove(L, -2); // remove Live2LOVE table
 }
 
-void RefData::getRef(lua_State *L, const std::string& name)
+void RefData::getRef(lua_State *L, NamedRefID id)
 {
-	if (namedRef.find(name) == namedRef.end())
+	if (namedRef[id] == LUA_NOREF)
 		lua_pushnil(L);
 	else
-		getRef(L, namedRef[name]);
+		getRef(L, namedRef[id]);
 }
 
 int RefData::setRef(lua_State *L, int luaval)
 {
 	luaval = toPositiveIndex(L, luaval);
-	lua_pushstring(L, "Live2LOVE");
-	lua_rawget(L, LUA_REGISTRYINDEX);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, mainTableRef);
 	lua_pushvalue(L, luaval);
 	int v = luaL_ref(L, -2);
 	lua_pop(L, 1); // pop the table
 	return v;
 }
 
-int RefData::setRef(lua_State *L, const std::string& name, int luaval)
+int RefData::setRef(lua_State *L, NamedRefID id, int luaval)
 {
-	if (namedRef.find(name) != namedRef.end())
-		delRef(L, namedRef[name]);
+	if (namedRef[id] != LUA_NOREF)
+		delRef(L, namedRef[id]);
 
-	return namedRef[name] = setRef(L, luaval);
+	return namedRef[id] = setRef(L, luaval);
 }
 
 void RefData::delRef(lua_State *L, int refID)
 {
-	lua_pushstring(L, "Live2LOVE");
-	lua_rawget(L, LUA_REGISTRYINDEX);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, mainTableRef);
 	luaL_unref(L, -1, refID);
 	lua_pop(L, 1);
 }
 
-void RefData::delRef(lua_State *L, const std::string& name)
+void RefData::delRef(lua_State *L, NamedRefID id)
 {
-	if (namedRef.find(name) != namedRef.end())
+	if (namedRef[id] != LUA_NOREF)
 	{
-		delRef(L, namedRef[name]);
-		namedRef.erase(name);
+		delRef(L, namedRef[id]);
+		namedRef[id] = LUA_NOREF;
 	}
 }
@@ -27,19 +27,59 @@
 // Lua reference of functions
 namespace RefData
 {
+	// Named references, resolved once when the module is loaded
+	enum NamedRefID
+	{
+		LIVE2LOVE_FFICAST,
+		LIVE2LOVE_THREADPOOLSENTINEL,
+		LOVE_DATA_NEWBYTEDATA,
+		LOVE_DATA_NEWDATAVIEW,
+		LOVE_FILESYSTEM_NEWFILEDATA,
+		LOVE_FILESYSTEM_READ,
+		LOVE_GRAPHICS_CLEAR,
+		LOVE_GRAPHICS_DRAW,
+		LOVE_GRAPHICS_DRAWINSTANCED,
+		LOVE_GRAPHICS_GETBLENDMODE,
+		LOVE_GRAPHICS_GETCOLOR,
+		LOVE_GRAPHICS_GETSCISSOR,
+		LOVE_GRAPHICS_GETSHADER,
+		LOVE_GRAPHICS_INTERSECTSCISSOR,
+		LOVE_GRAPHICS_NEWCANVAS,
+		LOVE_GRAPHICS_NEWIMAGE,
+		LOVE_GRAPHICS_NEWMESH,
+		LOVE_GRAPHICS_NEWSHADER,
+		LOVE_GRAPHICS_ORIGIN,
+		LOVE_GRAPHICS_POP,
+		LOVE_GRAPHICS_PUSH,
+		LOVE_GRAPHICS_RESET,
+		LOVE_GRAPHICS_SETBLENDMODE,
+		LOVE_GRAPHICS_SETCANVAS,
+		LOVE_GRAPHICS_SETCOLOR,
+		LOVE_GRAPHICS_SETCOLORMASK,
+		LOVE_GRAPHICS_SETSCISSOR,
+		LOVE_GRAPHICS_SETSHADER,
+		LOVE_GRAPHICS_SETSTENCILTEST,
+		LOVE_GRAPHICS_STENCIL,
+		LOVE_GRAPHICS_TRANSFORMPOINT,
+		NAMED_REF_MAX_ENUM
+	};
+
+	// Set table at index as the table which holds the references.
+	// Must be called before any other functions.
+	void setMainTable(lua_State *L, int idx);
 	// Push new object
 	void getRef(lua_State *L, int refID);
 	// Push new object or nil
-	void getRef(lua_State *L, const std::string& refName);
+	void getRef(lua_State *L, NamedRefID id);
 	// Returns new reference ID relative to Live2LOVE main table
 	// Does not affect stack number
 	int setRef(lua_State *L, int luaval);
-	// Same as setRef, but store it in map
-	int setRef(lua_State *L, const std::string& refName, int luaval);
+	// Same as setRef, but store it as named reference
+	int setRef(lua_State *L, NamedRefID id, int luaval);
 	// Removes reference
 	void delRef(lua_State *L, int refID);
 	// Removes reference, or do nothing
-	void delRef(lua_State *L, const std::string& refName);
+	void delRef(lua_State *L, NamedRefID id);
 };
 
 #endif
@@ -0,0 +1,266 @@
+/**
+ * Copyright (c) 2040 Dark Energy Processor Corporation
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+
+// STL
+#include <algorithm>
+
+// ThreadPool
+#include "ThreadPool.h"
+
+namespace live2love
+{
+
+ThreadPool *ThreadPool::instance = nullptr;
+
+ThreadPoolTask::ThreadPoolTask()
+: pending(false)
+{}
+
+bool ThreadPoolTask::isPending()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return pending;
+}
+
+ThreadPool::ThreadPool(int threads)
+: job(nullptr)
+, jobGeneration(0)
+, remaining(0)
+, quit(false)
+{
+	for (int i = 0; i <= threads; i++)
+		queues.emplace_back(new WorkQueue());
+
+	for (int i = 1; i <= threads; i++)
+		workers.emplace_back(&ThreadPool::workerMain, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		quit = true;
+	}
+
+	jobCondition.notify_all();
+
+	for (std::thread &worker: workers)
+		worker.join();
+
+	// Don't leave anyone waiting
+	for (ThreadPoolTask *task: tasks)
+		runTask(task);
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)> &func)
+{
+	if (count <= 0)
+		return;
+
+	// Not worth waking up workers for single item
+	if (count == 1 || workers.empty())
+	{
+		for (int i = 0; i < count; i++)
+			func(i);
+
+		return;
+	}
+
+	std::lock_guard<std::mutex> runLock(runMutex);
+	int queueCount = (int) queues.size();
+
+	// Job must be set before any item is visible, as workers of previous
+	// job may still be looking for work.
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		job = &func;
+		remaining = count;
+	}
+
+	// Distribute work round-robin
+	for (int i = 0; i < count; i++)
+	{
+		WorkQueue &queue = *queues[i % queueCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.items.push_back(i);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		jobGeneration++;
+	}
+
+	jobCondition.notify_all();
+
+	// Help the workers
+	while (runOne(0));
+
+	// Wait for items taken by workers
+	std::unique_lock<std::mutex> lock(jobMutex);
+	doneCondition.wait(lock, [this]() { return remaining == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::submit(ThreadPoolTask *task)
+{
+	{
+		std::lock_guard<std::mutex> lock(task->mutex);
+		task->pending = true;
+	}
+
+	if (workers.empty())
+	{
+		runTask(task);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		tasks.push_back(task);
+	}
+
+	jobCondition.notify_one();
+}
+
+void ThreadPool::wait(ThreadPoolTask *task)
+{
+	// Tasks only exist in a pool, so there's no pool if it's not pending.
+	if (!task->isPending())
+		return;
+
+	ThreadPool *pool = instance;
+
+	// Run it here if it's not started yet
+	{
+		std::unique_lock<std::mutex> lock(pool->jobMutex);
+		auto it = std::find(pool->tasks.begin(), pool->tasks.end(), task);
+
+		if (it != pool->tasks.end())
+		{
+			pool->tasks.erase(it);
+			lock.unlock();
+			runTask(task);
+			return;
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(task->mutex);
+	task->finished.wait(lock, [task]() { return !task->pending; });
+}
+
+void ThreadPool::runTask(ThreadPoolTask *task)
+{
+	task->run();
+
+	std::lock_guard<std::mutex> lock(task->mutex);
+	task->pending = false;
+	task->finished.notify_all();
+}
+
+bool ThreadPool::runOne(int self)
+{
+	int queueCount = (int) queues.size();
+	int item = -1;
+
+	// Own queue from the front, others from the back
+	for (int i = 0; i < queueCount && item == -1; i++)
+	{
+		WorkQueue &queue = *queues[(self + i) % queueCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (!queue.items.empty())
+		{
+			if (i == 0)
+			{
+				item = queue.items.front();
+				queue.items.pop_front();
+			}
+			else
+			{
+				item = queue.items.back();
+				queue.items.pop_back();
+			}
+		}
+	}
+
+	if (item == -1)
+		return false;
+
+	(*job)(item);
+
+	if (--remaining == 0)
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		doneCondition.notify_all();
+	}
+
+	return true;
+}
+
+void ThreadPool::workerMain(int self)
+{
+	unsigned int lastGeneration = 0;
+
+	while (true)
+	{
+		ThreadPoolTask *task = nullptr;
+
+		{
+			std::unique_lock<std::mutex> lock(jobMutex);
+			jobCondition.wait(lock, [&]() { return quit || jobGeneration != lastGeneration || !tasks.empty(); });
+
+			if (quit)
+				return;
+
+			// parallelFor comes first, as its caller is blocked
+			if (jobGeneration != lastGeneration)
+				lastGeneration = jobGeneration;
+			else
+			{
+				task = tasks.front();
+				tasks.pop_front();
+			}
+		}
+
+		if (task)
+			runTask(task);
+		else
+			while (runOne(self));
+	}
+}
+
+ThreadPool *ThreadPool::getInstance()
+{
+	if (instance == nullptr)
+	{
+		int threads = (int) std::thread::hardware_concurrency() - 1;
+		instance = new ThreadPool(threads > 0 ? threads : 0);
+	}
+
+	return instance;
+}
+
+void ThreadPool::destroyInstance()
+{
+	delete instance;
+	instance = nullptr;
+}
+
+} /* live2love */
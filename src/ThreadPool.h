@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2040 Dark Energy Processor Corporation
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+
+#ifndef _L2L_THREADPOOL_
+#define _L2L_THREADPOOL_
+
+// STL
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace live2love
+{
+	// Task which runs in the background using ThreadPool::submit
+	class ThreadPoolTask
+	{
+	public:
+		ThreadPoolTask();
+		virtual ~ThreadPoolTask() {}
+		virtual void run() = 0;
+		// Is the task submitted but not yet finished?
+		bool isPending();
+
+	private:
+		friend class ThreadPool;
+		std::mutex mutex;
+		std::condition_variable finished;
+		bool pending;
+	};
+
+	// Fixed-size worker pool. Work is distributed to per-thread queues and
+	// threads which ran out of work steal from the others.
+	class ThreadPool
+	{
+	public:
+		// Create new thread pool with specified amount of worker threads.
+		ThreadPool(int threads);
+		~ThreadPool();
+		// Call func(i) for i in [0, count) using worker threads and the
+		// calling thread. Returns after all calls are finished. func must not throw.
+		void parallelFor(int count, const std::function<void(int)> &func);
+		// Run task in a worker thread. Task must not be pending already.
+		void submit(ThreadPoolTask *task);
+		// Wait until the task is finished. If no worker has picked the task
+		// yet, it runs in the calling thread instead.
+		static void wait(ThreadPoolTask *task);
+		// Get shared thread pool, created on first use.
+		static ThreadPool *getInstance();
+		// Destroy shared thread pool. Must be called before the module is unloaded.
+		static void destroyInstance();
+
+	private:
+		struct WorkQueue
+		{
+			std::mutex mutex;
+			std::deque<int> items;
+		};
+
+		// Worker threads
+		std::vector<std::thread> workers;
+		// Work queue for each worker, plus one for the calling thread (index 0)
+		std::vector<std::unique_ptr<WorkQueue>> queues;
+		// Only one parallelFor at a time
+		std::mutex runMutex;
+		// Job state
+		std::mutex jobMutex;
+		std::condition_variable jobCondition, doneCondition;
+		const std::function<void(int)> *job;
+		unsigned int jobGeneration;
+		std::atomic<int> remaining;
+		bool quit;
+		// Background tasks
+		std::deque<ThreadPoolTask*> tasks;
+
+		static ThreadPool *instance;
+
+		// Run one item from own queue or stolen from others. Returns false if there's no work left.
+		bool runOne(int self);
+		void workerMain(int self);
+		static void runTask(ThreadPoolTask *task);
+	};
+}
+
+#endif
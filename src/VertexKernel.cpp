@@ -0,0 +1,282 @@
+/**
+ * Copyright (c) 2040 Dark Energy Processor Corporation
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+// VertexKernel
+#include "VertexKernel.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define L2L_VERTEXKERNEL_SSE2
+#	include <emmintrin.h>
+#	if defined(_MSC_VER) || defined(__GNUC__)
+#		define L2L_VERTEXKERNEL_AVX2
+#		include <immintrin.h>
+#		ifdef _MSC_VER
+#			include <intrin.h>
+#			define L2L_TARGET_AVX2
+#		else
+#			define L2L_TARGET_AVX2 __attribute__((target("avx2")))
+#		endif
+#	endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__) || defined(_M_ARM64)
+#	define L2L_VERTEXKERNEL_NEON
+#	include <arm_neon.h>
+#endif
+
+using live2love::Live2LOVEMeshFormat;
+using Live2D::Cubism::Core::csmVector2;
+
+typedef void (*TransformFunc)(Live2LOVEMeshFormat*, const csmVector2*, int, float, float, float, float*);
+
+// Reference implementation. SIMD variants must give the same result.
+// Bounds are merged to the existing bounds.
+static void transformScalar(Live2LOVEMeshFormat *dest, const csmVector2 *src, int count, float scale, float offX, float offY, float *bounds)
+{
+	float minX = bounds[0], minY = bounds[1], maxX = bounds[2], maxY = bounds[3];
+
+	for (int i = 0; i < count; i++)
+	{
+		float x = src[i].X * scale + offX;
+		float y = src[i].Y * -scale + offY;
+		dest[i].x = x;
+		dest[i].y = y;
+		minX = std::min(minX, x);
+		minY = std::min(minY, y);
+		maxX = std::max(maxX, x);
+		maxY = std::max(maxY, y);
+	}
+
+	bounds[0] = minX;
+	bounds[1] = minY;
+	bounds[2] = maxX;
+	bounds[3] = maxY;
+}
+
+#ifdef L2L_VERTEXKERNEL_SSE2
+// 2 vertices per vector. x and y are stored as one 64-bit lane each.
+static void transformSSE2(Live2LOVEMeshFormat *dest, const csmVector2 *src, int count, float scale, float offX, float offY, float *bounds)
+{
+	const __m128 mul = _mm_setr_ps(scale, -scale, scale, -scale);
+	const __m128 add = _mm_setr_ps(offX, offY, offX, offY);
+	__m128 vmin = _mm_setr_ps(bounds[0], bounds[1], bounds[0], bounds[1]);
+	__m128 vmax = _mm_setr_ps(bounds[2], bounds[3], bounds[2], bounds[3]);
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 a = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&src[i].X), mul), add);
+		__m128 b = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&src[i + 2].X), mul), add);
+		_mm_storel_pi((__m64 *) &dest[i].x, a);
+		_mm_storeh_pi((__m64 *) &dest[i + 1].x, a);
+		_mm_storel_pi((__m64 *) &dest[i + 2].x, b);
+		_mm_storeh_pi((__m64 *) &dest[i + 3].x, b);
+		vmin = _mm_min_ps(vmin, _mm_min_ps(a, b));
+		vmax = _mm_max_ps(vmax, _mm_max_ps(a, b));
+	}
+
+	// Reduce to x, y pair
+	vmin = _mm_min_ps(vmin, _mm_movehl_ps(vmin, vmin));
+	vmax = _mm_max_ps(vmax, _mm_movehl_ps(vmax, vmax));
+	_mm_storel_pi((__m64 *) &bounds[0], vmin);
+	_mm_storel_pi((__m64 *) &bounds[2], vmax);
+
+	transformScalar(dest + i, src + i, count - i, scale, offX, offY, bounds);
+}
+#endif
+
+#ifdef L2L_VERTEXKERNEL_AVX2
+// 4 vertices per vector
+L2L_TARGET_AVX2 static void transformAVX2(Live2LOVEMeshFormat *dest, const csmVector2 *src, int count, float scale, float offX, float offY, float *bounds)
+{
+	const __m256 mul = _mm256_setr_ps(scale, -scale, scale, -scale, scale, -scale, scale, -scale);
+	const __m256 add = _mm256_setr_ps(offX, offY, offX, offY, offX, offY, offX, offY);
+	__m256 vmin = _mm256_setr_ps(bounds[0], bounds[1], bounds[0], bounds[1], bounds[0], bounds[1], bounds[0], bounds[1]);
+	__m256 vmax = _mm256_setr_ps(bounds[2], bounds[3], bounds[2], bounds[3], bounds[2], bounds[3], bounds[2], bounds[3]);
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&src[i].X), mul), add);
+		__m128 lo = _mm256_castps256_ps128(v);
+		__m128 hi = _mm256_extractf128_ps(v, 1);
+		_mm_storel_pi((__m64 *) &dest[i].x, lo);
+		_mm_storeh_pi((__m64 *) &dest[i + 1].x, lo);
+		_mm_storel_pi((__m64 *) &dest[i + 2].x, hi);
+		_mm_storeh_pi((__m64 *) &dest[i + 3].x, hi);
+		vmin = _mm256_min_ps(vmin, v);
+		vmax = _mm256_max_ps(vmax, v);
+	}
+
+	// Reduce to x, y pair
+	__m128 min4 = _mm_min_ps(_mm256_castps256_ps128(vmin), _mm256_extractf128_ps(vmin, 1));
+	__m128 max4 = _mm_max_ps(_mm256_castps256_ps128(vmax), _mm256_extractf128_ps(vmax, 1));
+	_mm_storel_pi((__m64 *) &bounds[0], _mm_min_ps(min4, _mm_movehl_ps(min4, min4)));
+	_mm_storel_pi((__m64 *) &bounds[2], _mm_max_ps(max4, _mm_movehl_ps(max4, max4)));
+
+	_mm256_zeroupper();
+	transformScalar(dest + i, src + i, count - i, scale, offX, offY, bounds);
+}
+
+static bool hasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// OSXSAVE and AVX
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+		return false;
+
+	// OS must save YMM registers
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif
+
+#ifdef L2L_VERTEXKERNEL_NEON
+// 2 vertices per vector
+static void transformNEON(Live2LOVEMeshFormat *dest, const csmVector2 *src, int count, float scale, float offX, float offY, float *bounds)
+{
+	const float mulArr[4] = {scale, -scale, scale, -scale};
+	const float addArr[4] = {offX, offY, offX, offY};
+	const float minArr[4] = {bounds[0], bounds[1], bounds[0], bounds[1]};
+	const float maxArr[4] = {bounds[2], bounds[3], bounds[2], bounds[3]};
+	const float32x4_t mul = vld1q_f32(mulArr);
+	const float32x4_t add = vld1q_f32(addArr);
+	float32x4_t vmin = vld1q_f32(minArr);
+	float32x4_t vmax = vld1q_f32(maxArr);
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		// Separate multiply and add (not vmlaq/vfmaq) to match the scalar rounding
+		float32x4_t a = vaddq_f32(vmulq_f32(vld1q_f32(&src[i].X), mul), add);
+		float32x4_t b = vaddq_f32(vmulq_f32(vld1q_f32(&src[i + 2].X), mul), add);
+		vst1_f32(&dest[i].x, vget_low_f32(a));
+		vst1_f32(&dest[i + 1].x, vget_high_f32(a));
+		vst1_f32(&dest[i + 2].x, vget_low_f32(b));
+		vst1_f32(&dest[i + 3].x, vget_high_f32(b));
+		vmin = vminq_f32(vmin, vminq_f32(a, b));
+		vmax = vmaxq_f32(vmax, vmaxq_f32(a, b));
+	}
+
+	// Reduce to x, y pair
+	vst1_f32(&bounds[0], vmin_f32(vget_low_f32(vmin), vget_high_f32(vmin)));
+	vst1_f32(&bounds[2], vmax_f32(vget_low_f32(vmax), vget_high_f32(vmax)));
+
+	transformScalar(dest + i, src + i, count - i, scale, offX, offY, bounds);
+}
+#endif
+
+static TransformFunc getTransform(VertexKernel::Implementation impl)
+{
+	switch (impl)
+	{
+		case VertexKernel::IMPL_SCALAR:
+			return transformScalar;
+#ifdef L2L_VERTEXKERNEL_SSE2
+		case VertexKernel::IMPL_SSE2:
+			return transformSSE2;
+#endif
+#ifdef L2L_VERTEXKERNEL_AVX2
+		case VertexKernel::IMPL_AVX2:
+			return hasAVX2() ? transformAVX2 : nullptr;
+#endif
+#ifdef L2L_VERTEXKERNEL_NEON
+		case VertexKernel::IMPL_NEON:
+			return transformNEON;
+#endif
+		default:
+			return nullptr;
+	}
+}
+
+static TransformFunc selectTransform()
+{
+	static const VertexKernel::Implementation order[] = {
+		VertexKernel::IMPL_AVX2,
+		VertexKernel::IMPL_SSE2,
+		VertexKernel::IMPL_NEON
+	};
+
+	for (VertexKernel::Implementation impl: order)
+	{
+		if (TransformFunc func = getTransform(impl))
+			return func;
+	}
+
+	return transformScalar;
+}
+
+static void runTransform(TransformFunc func, Live2LOVEMeshFormat *dest, const csmVector2 *src, int count, float scale, float offX, float offY, float *bounds)
+{
+	bounds[0] = bounds[1] = std::numeric_limits<float>::infinity();
+	bounds[2] = bounds[3] = -std::numeric_limits<float>::infinity();
+	func(dest, src, count, scale, offX, offY, bounds);
+}
+
+void VertexKernel::transform(Live2LOVEMeshFormat *dest, const csmVector2 *src, int count, float scale, float offX, float offY, float *bounds)
+{
+	// Selected once, thread-safe static initialization
+	static const TransformFunc func = selectTransform();
+	runTransform(func, dest, src, count, scale, offX, offY, bounds);
+}
+
+bool VertexKernel::isSupported(Implementation impl)
+{
+	return getTransform(impl) != nullptr;
+}
+
+void VertexKernel::transform(Implementation impl, Live2LOVEMeshFormat *dest, const csmVector2 *src, int count, float scale, float offX, float offY, float *bounds)
+{
+	runTransform(getTransform(impl), dest, src, count, scale, offX, offY, bounds);
+}
+
+void VertexKernel::fillAlpha(Live2LOVEMeshFormat *dest, int count, unsigned char alpha, bool allChannels)
+{
+	// Color is interleaved with the vertex positions,
+	// so there's not much to gain with SIMD here.
+	if (allChannels)
+	{
+		unsigned char color[4] = {alpha, alpha, alpha, alpha};
+
+		for (int i = 0; i < count; i++)
+			memcpy(&dest[i].r, color, 4);
+	}
+	else
+	{
+		for (int i = 0; i < count; i++)
+			dest[i].a = alpha;
+	}
+}
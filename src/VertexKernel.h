@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) 2040 Dark Energy Processor Corporation
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+
+#ifndef _L2L_VERTEXKERNEL_
+#define _L2L_VERTEXKERNEL_
+
+// Live2LOVE
+#include "Live2LOVE.h"
+
+// Vertex update kernels, SIMD-accelerated when possible
+namespace VertexKernel
+{
+	// Transform Live2D vertex positions to LOVE mesh vertex positions:
+	// x = X * scale + offX, y = Y * -scale + offY
+	// Bounding box of the result is stored to bounds as minX, minY, maxX, maxY.
+	void transform(live2love::Live2LOVEMeshFormat *dest, const Live2D::Cubism::Core::csmVector2 *src, int count, float scale, float offX, float offY, float *bounds);
+	// Set the alpha of vertices. If allChannels is true, r, g, and b are set too.
+	void fillAlpha(live2love::Live2LOVEMeshFormat *dest, int count, unsigned char alpha, bool allChannels);
+
+	// Transform implementations. transform picks the best supported one.
+	enum Implementation
+	{
+		IMPL_SCALAR,
+		IMPL_SSE2,
+		IMPL_AVX2,
+		IMPL_NEON,
+		IMPL_MAX_ENUM
+	};
+
+	// Returns true if the implementation is built in and supported by the CPU
+	bool isSupported(Implementation impl);
+	// Same as transform, but with specified implementation, which must be
+	// supported
+	void transform(Implementation impl, live2love::Live2LOVEMeshFormat *dest, const Live2D::Cubism::Core::csmVector2 *src, int count, float scale, float offX, float offY, float *bounds);
+};
+
+#endif
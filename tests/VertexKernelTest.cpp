@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) 2040 Dark Energy Processor Corporation
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+
+// Checks SIMD vertex kernels against the scalar implementation.
+// Returns nonzero if any of them differs.
+
+// std
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// VertexKernel
+#include "VertexKernel.h"
+
+using live2love::Live2LOVEMeshFormat;
+using Live2D::Cubism::Core::csmVector2;
+
+static const char *implNames[VertexKernel::IMPL_MAX_ENUM] = {"scalar", "SSE2", "AVX2", "NEON"};
+static int failures = 0;
+
+// Deterministic pseudo-random float in [-range, range)
+static float randomFloat(unsigned int &seed, float range)
+{
+	seed = seed * 1103515245u + 12345u;
+	return ((float) ((seed >> 8) & 0xFFFF) / 32768.0f - 1.0f) * range;
+}
+
+static void fail(const char *what, VertexKernel::Implementation impl, int count, int offset)
+{
+	fprintf(stderr, "%s: %s mismatch (count %d, offset %d)\n", implNames[impl], what, count, offset);
+	failures++;
+}
+
+static void fillVertices(std::vector<Live2LOVEMeshFormat> &vertices)
+{
+	// Non-position values must be left untouched by transform
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		Live2LOVEMeshFormat &v = vertices[i];
+		v.x = v.y = -12345.0f;
+		v.r = (unsigned char) i;
+		v.g = (unsigned char) (i * 3);
+		v.b = (unsigned char) (i * 7);
+		v.a = (unsigned char) (i * 11);
+	}
+}
+
+// Compare transform with the scalar implementation. offset misaligns src
+// and dest.
+static void testTransform(VertexKernel::Implementation impl, int count, int offset)
+{
+	unsigned int seed = (unsigned int) (count * 31 + offset);
+	std::vector<csmVector2> src(count + offset);
+	std::vector<Live2LOVEMeshFormat> expected(count + offset), actual(count + offset);
+
+	for (csmVector2 &v: src)
+	{
+		v.X = randomFloat(seed, 2.0f);
+		v.Y = randomFloat(seed, 2.0f);
+	}
+
+	fillVertices(expected);
+	fillVertices(actual);
+
+	float scale = 123.456f, offX = 321.5f, offY = -45.25f;
+	float expectedBounds[4], actualBounds[4];
+	VertexKernel::transform(VertexKernel::IMPL_SCALAR, expected.data() + offset, src.data() + offset, count, scale, offX, offY, expectedBounds);
+	VertexKernel::transform(impl, actual.data() + offset, src.data() + offset, count, scale, offX, offY, actualBounds);
+
+	if (memcmp(expected.data(), actual.data(), expected.size() * sizeof(Live2LOVEMeshFormat)) != 0)
+		fail("vertex", impl, count, offset);
+	if (memcmp(expectedBounds, actualBounds, sizeof(expectedBounds)) != 0)
+		fail("bounds", impl, count, offset);
+}
+
+// Check the scalar implementation itself against plain math
+static void testScalarBounds()
+{
+	const csmVector2 src[3] = {{-1.0f, 2.0f}, {3.0f, -4.0f}, {0.5f, 0.25f}};
+	Live2LOVEMeshFormat dest[3];
+	float bounds[4];
+
+	VertexKernel::transform(VertexKernel::IMPL_SCALAR, dest, src, 3, 2.0f, 10.0f, 20.0f, bounds);
+	if (dest[1].x != 16.0f || dest[1].y != 28.0f)
+		fail("vertex", VertexKernel::IMPL_SCALAR, 3, 0);
+	if (bounds[0] != 8.0f || bounds[1] != 16.0f || bounds[2] != 16.0f || bounds[3] != 28.0f)
+		fail("bounds", VertexKernel::IMPL_SCALAR, 3, 0);
+
+	// No vertices gives empty bounds
+	VertexKernel::transform(VertexKernel::IMPL_SCALAR, dest, src, 0, 2.0f, 10.0f, 20.0f, bounds);
+	if (!(bounds[0] > bounds[2]) || !(bounds[1] > bounds[3]))
+		fail("empty bounds", VertexKernel::IMPL_SCALAR, 0, 0);
+}
+
+static void testFillAlpha(int count)
+{
+	std::vector<Live2LOVEMeshFormat> vertices(count + 1);
+	fillVertices(vertices);
+	std::vector<Live2LOVEMeshFormat> original = vertices;
+
+	VertexKernel::fillAlpha(vertices.data(), count, 200, false);
+	for (int i = 0; i <= count; i++)
+	{
+		const Live2LOVEMeshFormat &v = vertices[i], &o = original[i];
+		unsigned char a = i < count ? 200 : o.a;
+
+		if (v.x != o.x || v.y != o.y || v.r != o.r || v.g != o.g || v.b != o.b || v.a != a)
+		{
+			fail("fillAlpha", VertexKernel::IMPL_SCALAR, count, 0);
+			break;
+		}
+	}
+
+	VertexKernel::fillAlpha(vertices.data(), count, 100, true);
+	for (int i = 0; i <= count; i++)
+	{
+		const Live2LOVEMeshFormat &v = vertices[i], &o = original[i];
+		bool set = i < count;
+
+		if (v.x != o.x || v.y != o.y ||
+			v.r != (set ? 100 : o.r) || v.g != (set ? 100 : o.g) || v.b != (set ? 100 : o.b) || v.a != (set ? 100 : o.a))
+		{
+			fail("fillAlpha all channels", VertexKernel::IMPL_SCALAR, count, 0);
+			break;
+		}
+	}
+}
+
+int main()
+{
+	testScalarBounds();
+
+	for (int count = 0; count < 40; count++)
+		testFillAlpha(count);
+
+	for (int i = VertexKernel::IMPL_SCALAR + 1; i < VertexKernel::IMPL_MAX_ENUM; i++)
+	{
+		VertexKernel::Implementation impl = (VertexKernel::Implementation) i;
+
+		if (!VertexKernel::isSupported(impl))
+		{
+			printf("%s: not supported, skipped\n", implNames[impl]);
+			continue;
+		}
+
+		// Every tail length of the vector loops, then some larger counts
+		for (int count = 0; count < 40; count++)
+		{
+			testTransform(impl, count, 0);
+			testTransform(impl, count, 1);
+		}
+
+		for (int count: {255, 256, 1021, 4096})
+		{
+			testTransform(impl, count, 0);
+			testTransform(impl, count, 3);
+		}
+
+		printf("%s: tested\n", implNames[impl]);
+	}
+
+	if (failures > 0)
+	{
+		fprintf(stderr, "%d failures\n", failures);
+		return 1;
+	}
+
+	return 0;
+}